@@ -0,0 +1,106 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+  //
+  // Blocks from operator new[] are aligned for anything already.
+  //
+  if (size >= kMaxBlockSize)
+  {
+    //
+    // Dedicated block, so that what's left of the current one isn't lost.
+    //
+    _blocks.emplace_back(new char[size]);
+
+    _bytesUsed     += size;
+    _bytesReserved += size;
+
+    return _blocks.back().get();
+  }
+
+  size_t padding = (alignment - ((uintptr_t)_current & (alignment - 1)))
+                 & (alignment - 1);
+
+  if (_current == nullptr or padding + size > _left)
+  {
+    size_t blockSize = std::max(_nextBlockSize, size);
+
+    _blocks.emplace_back(new char[blockSize]);
+
+    _current = _blocks.back().get();
+    _left    = blockSize;
+    padding  = 0;
+
+    _bytesReserved += blockSize;
+
+    if (_nextBlockSize < kMaxBlockSize)
+    {
+      _nextBlockSize *= 2;
+    }
+  }
+
+  char* p = _current + padding;
+
+  _current += padding + size;
+  _left    -= padding + size;
+
+  _bytesUsed += size;
+
+  return p;
+}
+
+// =============================================================================
+
+std::string_view Arena::Store(std::string_view s)
+{
+  if (s.empty())
+  {
+    return std::string_view();
+  }
+
+  char* p = (char*)Allocate(s.size(), 1);
+
+  std::memcpy(p, s.data(), s.size());
+
+  return std::string_view(p, s.size());
+}
+
+// =============================================================================
+
+void Arena::Clear()
+{
+  _blocks.clear();
+
+  _current = nullptr;
+  _left    = 0;
+
+  _nextBlockSize = kFirstBlockSize;
+
+  _bytesUsed     = 0;
+  _bytesReserved = 0;
+}
+
+// =============================================================================
+
+size_t Arena::BytesUsed() const
+{
+  return _bytesUsed;
+}
+
+// =============================================================================
+
+size_t Arena::BytesReserved() const
+{
+  return _bytesReserved;
+}
+
+// =============================================================================
+
+size_t Arena::BlocksCount() const
+{
+  return _blocks.size();
+}
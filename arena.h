@@ -0,0 +1,72 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+//
+// Bump allocator: memory is handed out from big blocks one after another
+// and is only freed all at once by Clear() or destructor.
+// Nothing is ever destroyed, so only trivially destructible data (or data
+// which destructors don't matter) should live here.
+//
+// Blocks grow twice in size each time up to kMaxBlockSize, anything bigger
+// than that gets a block of its own.
+//
+class Arena
+{
+  public:
+    Arena() = default;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    //
+    // Uninitialized storage for count objects of type T.
+    //
+    template <typename T>
+    T* AllocateArray(size_t count)
+    {
+      return (T*)Allocate(sizeof(T) * count, alignof(T));
+    }
+
+    //
+    // Copies s into arena.
+    //
+    std::string_view Store(std::string_view s);
+
+    void Clear();
+
+    //
+    // Sum of all requested sizes.
+    //
+    size_t BytesUsed() const;
+
+    //
+    // Sum of all block sizes.
+    //
+    size_t BytesReserved() const;
+
+    size_t BlocksCount() const;
+
+  private:
+    static constexpr size_t kFirstBlockSize = 4 * 1024;
+    static constexpr size_t kMaxBlockSize   = 1024 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> _blocks;
+
+    char* _current = nullptr;
+
+    size_t _left = 0;
+
+    size_t _nextBlockSize = kFirstBlockSize;
+
+    size_t _bytesUsed     = 0;
+    size_t _bytesReserved = 0;
+};
+
+#endif // ARENA_H
@@ -0,0 +1,2603 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <new>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <filesystem>
+
+#if defined(_WIN32)
+  #include <malloc.h>
+  #define WIN32_LEAN_AND_MEAN
+  #define NOMINMAX
+  #include <windows.h>
+  #include <psapi.h>
+#elif defined(__APPLE__)
+  #include <malloc/malloc.h>
+  #include <mach/mach.h>
+  #include <sys/resource.h>
+#else
+  #include <malloc.h>
+  #include <sys/resource.h>
+#endif
+
+#include "bg-image.h"
+#include "bg-effect.h"
+#include "mapped-file.h"
+#include "nrs.h"
+#include "sine-lut.h"
+#include "thread-pool.h"
+#include "util.h"
+
+using Clock = std::chrono::steady_clock;
+
+const double PIOVER180 = 0.017453292519943295;
+
+//
+// Prevents compiler from throwing away results of benchmarked loops.
+//
+volatile uint32_t Sink = 0;
+
+//
+// Animation step for benchmarks that animate, as if running at 60 fps.
+//
+const double kFrameTime = 1.0 / 60.0;
+
+//
+// Every operator new / delete goes through these, so that memory used by
+// NRS can be measured. Counting is only on inside MeasureHeap(), the rest
+// of the time it's plain malloc / free plus one relaxed load, so other
+// sections are not affected.
+//
+// Sizes are the ones allocator actually gave, so blocks don't need a size
+// header of our own.
+//
+std::atomic<bool> HeapCounting{false};
+
+std::atomic<size_t>  HeapAllocations{0};
+std::atomic<int64_t> HeapLiveBytes{0};
+std::atomic<int64_t> HeapPeakBytes{0};
+
+// =============================================================================
+
+size_t HeapBlockSize(void* p)
+{
+#if defined(_WIN32)
+  return _msize(p);
+#elif defined(__APPLE__)
+  return malloc_size(p);
+#else
+  return malloc_usable_size(p);
+#endif
+}
+
+// =============================================================================
+
+void* operator new(size_t size)
+{
+  void* p = std::malloc((size != 0) ? size : 1);
+  if (p == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+
+  if (HeapCounting.load(std::memory_order_relaxed))
+  {
+    HeapAllocations++;
+
+    int64_t live = (HeapLiveBytes += (int64_t)HeapBlockSize(p));
+    int64_t peak = HeapPeakBytes.load();
+
+    while (live > peak and not HeapPeakBytes.compare_exchange_weak(peak, live))
+    {
+    }
+  }
+
+  return p;
+}
+
+// =============================================================================
+
+void operator delete(void* ptr) noexcept
+{
+  if (ptr == nullptr)
+  {
+    return;
+  }
+
+  //
+  // Blocks allocated before counting started are subtracted too, so live
+  // bytes are relative and can go below zero.
+  //
+  if (HeapCounting.load(std::memory_order_relaxed))
+  {
+    HeapLiveBytes -= (int64_t)HeapBlockSize(ptr);
+  }
+
+  std::free(ptr);
+}
+
+// =============================================================================
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+// =============================================================================
+
+void operator delete[](void* ptr) noexcept
+{
+  operator delete(ptr);
+}
+
+// =============================================================================
+
+void operator delete(void* ptr, size_t) noexcept
+{
+  operator delete(ptr);
+}
+
+// =============================================================================
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+  operator delete(ptr);
+}
+
+// =============================================================================
+
+struct HeapUsage
+{
+  size_t  Allocations   = 0;
+  int64_t PeakBytes     = 0;
+  int64_t RetainedBytes = 0;
+};
+
+// =============================================================================
+
+//
+// Heap used by fn() at its peak and what's left allocated after it returns.
+//
+HeapUsage MeasureHeap(const std::function<void()>& fn)
+{
+  HeapAllocations = 0;
+  HeapLiveBytes   = 0;
+  HeapPeakBytes   = 0;
+
+  HeapCounting = true;
+
+  fn();
+
+  HeapCounting = false;
+
+  HeapUsage usage;
+  usage.Allocations   = HeapAllocations;
+  usage.PeakBytes     = HeapPeakBytes;
+  usage.RetainedBytes = HeapLiveBytes;
+
+  return usage;
+}
+
+// =============================================================================
+
+//
+// Resident set size of the process: heap, stacks and whatever pages of
+// mapped files were touched. Unlike heap bytes above, this is what the OS
+// actually holds in memory for us.
+//
+struct RssUsage
+{
+  size_t Before = 0;
+  size_t Peak   = 0;
+
+  //
+  // Peak can be reset on Linux only, elsewhere it's the peak of the whole
+  // process so far, which is only meaningful if nothing before went higher.
+  //
+  bool PeakIsOwn = false;
+};
+
+// =============================================================================
+
+#ifdef __linux__
+
+//
+// VmRSS / VmHWM from /proc/self/status, getrusage() peak can't be reset.
+//
+size_t ReadProcStatusBytes(const char* key)
+{
+  std::ifstream in("/proc/self/status");
+
+  std::string line;
+
+  while (std::getline(in, line))
+  {
+    if (line.compare(0, std::strlen(key), key) == 0)
+    {
+      return std::strtoull(line.data() + std::strlen(key), nullptr, 10) * 1024;
+    }
+  }
+
+  return 0;
+}
+
+#endif
+
+// =============================================================================
+
+size_t CurrentRss()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS pmc{};
+  GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+  return pmc.WorkingSetSize;
+#elif defined(__APPLE__)
+  mach_task_basic_info info{};
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count);
+  return info.resident_size;
+#elif defined(__linux__)
+  return ReadProcStatusBytes("VmRSS:");
+#else
+  return 0;
+#endif
+}
+
+// =============================================================================
+
+size_t PeakRss()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS pmc{};
+  GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+  return pmc.PeakWorkingSetSize;
+#elif defined(__linux__)
+  return ReadProcStatusBytes("VmHWM:");
+#else
+  struct rusage ru{};
+  getrusage(RUSAGE_SELF, &ru);
+  //
+  // Bytes on macOS.
+  //
+  return (size_t)ru.ru_maxrss;
+#endif
+}
+
+// =============================================================================
+
+//
+// Writing "5" to clear_refs resets VmHWM to current RSS (Linux 4.0+).
+//
+bool ResetPeakRss()
+{
+#ifdef __linux__
+  FILE* f = std::fopen("/proc/self/clear_refs", "w");
+  if (f == nullptr)
+  {
+    return false;
+  }
+
+  bool ok = (std::fputs("5", f) >= 0);
+
+  return (std::fclose(f) == 0 and ok);
+#else
+  return false;
+#endif
+}
+
+// =============================================================================
+
+//
+// RSS right before fn() and at its peak. Memory freed by previous sections
+// is given back to OS first where possible, so that it doesn't get reused
+// and hide part of what fn() takes.
+//
+RssUsage MeasureRss(const std::function<void()>& fn)
+{
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+
+  RssUsage usage;
+  usage.PeakIsOwn = ResetPeakRss();
+  usage.Before    = CurrentRss();
+
+  fn();
+
+  usage.Peak = PeakRss();
+
+  return usage;
+}
+
+// =============================================================================
+
+//
+// Original per-pixel effect loop with double angles and std::sin(),
+// writing into the same tables BuildOffsetTables() does.
+//
+void BuildOffsetTablesStdSin(BgImage& bg,
+                             double& angleX,
+                             double& angleY,
+                             double angleIncreaseX,
+                             double angleIncreaseY,
+                             OffsetTables& tables)
+{
+  tables.Resize(bg.Width, bg.Height);
+
+  for (uint32_t y = 0; y < bg.Height; y++)
+  {
+    size_t iy = y + bg.ScrollPosY + (size_t)bg.ScanlineOffsetY;
+
+    tables.SourceRow[y] = iy % bg.Height;
+
+    uint16_t* columns = tables.Columns(y);
+
+    for (uint32_t x = 0; x < bg.Width; x++)
+    {
+      bg.ScanlineOffsetX = (int)(std::sin(angleX * PIOVER180) * bg.ScanlineFactorX);
+      if (bg.ScanlineOffsetX < 0)
+      {
+        bg.ScanlineOffsetX += (bg.Width - 1);
+      }
+
+      size_t ix = x + bg.ScrollPosX + (size_t)bg.ScanlineOffsetX;
+
+      columns[x] = ix % bg.Width;
+
+      angleX += angleIncreaseX;
+      angleY += angleIncreaseY;
+
+      if (angleX > 360.0)
+      {
+        angleX = 360.0 - angleX;
+      }
+
+      if (angleY > 360.0)
+      {
+        angleY = 360.0 - angleY;
+      }
+    }
+
+    bg.ScanlineOffsetY = (int)(std::sin(angleY * PIOVER180) * bg.ScanlineFactorY);
+    if (bg.ScanlineOffsetY < 0)
+    {
+      bg.ScanlineOffsetY += (bg.Height - 1);
+    }
+  }
+}
+
+// =============================================================================
+
+void Report(const char* name,
+            size_t frames,
+            size_t framePixels,
+            double seconds)
+{
+  const double pixels = (double)frames * framePixels;
+  const double nsPerFrame = seconds * 1e9 / (double)frames;
+  const double mpxPerSec  = pixels / seconds / 1e6;
+
+  //
+  // How long one 3840x2160 frame would take at the same pixel rate.
+  //
+  const double ms4k = (3840.0 * 2160.0) / (pixels / seconds) * 1e3;
+
+  printf("%-32s %12.0f ns/frame %10.1f Mpx/s %8.3f ms/4K frame\n",
+         name, nsPerFrame, mpxPerSec, ms4k);
+}
+
+// =============================================================================
+
+void BenchSineVsLut(size_t frames)
+{
+  printf("--- effect loop: std::sin vs sine LUT (%zu frames) ---\n", frames);
+
+  const uint32_t kSize = 256;
+
+  std::unique_ptr<BgImage> bg = std::make_unique<BgImage>();
+  std::unique_ptr<OffsetTables> tables = std::make_unique<OffsetTables>();
+
+  bg->SetPixels(kSize, kSize, std::vector<uint32_t>(kSize * kSize));
+
+  const size_t framePixels = kSize * kSize;
+
+  bg->ScrollPosX = 17;
+  bg->ScrollPosY = 5;
+  bg->ScanlineFactorX = 8.5;
+  bg->ScanlineFactorY = 3.25;
+
+  const double angleIncreaseX = 0.05;
+  const double angleIncreaseY = 0.37;
+
+  double angleX = 0.0;
+  double angleY = 0.0;
+
+  Clock::time_point tp = Clock::now();
+
+  for (size_t i = 0; i < frames; i++)
+  {
+    BuildOffsetTablesStdSin(*bg,
+                            angleX, angleY,
+                            angleIncreaseX, angleIncreaseY,
+                            *tables);
+    Sink += tables->SourceColumn[i % framePixels];
+  }
+
+  Report("std::sin",
+         frames,
+         framePixels,
+         std::chrono::duration<double>(Clock::now() - tp).count());
+
+  const uint32_t phaseIncX = DegreesToPhase(angleIncreaseX);
+  const uint32_t phaseIncY = DegreesToPhase(angleIncreaseY);
+
+  tp = Clock::now();
+
+  for (size_t i = 0; i < frames; i++)
+  {
+    BuildOffsetTables(*bg, phaseIncX, phaseIncY, *tables);
+    AdvanceBackground(*bg, phaseIncX, phaseIncY, bg->Width, bg->Height, kFrameTime);
+    Sink += tables->SourceColumn[i % framePixels];
+  }
+
+  Report("sine LUT",
+         frames,
+         framePixels,
+         std::chrono::duration<double>(Clock::now() - tp).count());
+}
+
+//
+// Color of source pixel i with palette cycling applied, resolved the way it
+// was before palette kernels: branch on "not in palette" and modulo.
+//
+uint32_t ResolvePixelModulo(const BgImage& bg, size_t i)
+{
+  uint32_t color        = 0;
+  uint8_t  paletteIndex = kNotInPalette;
+
+  if (bg.IsIndexed())
+  {
+    color        = bg.Colors[bg.Indices[i]];
+    paletteIndex = bg.PaletteEntryByColor[bg.Indices[i]];
+  }
+  else
+  {
+    color = bg.TrueColor[i];
+
+    if (not bg.PaletteIndices.empty())
+    {
+      paletteIndex = bg.PaletteIndices[i];
+    }
+  }
+
+  if (paletteIndex == kNotInPalette)
+  {
+    return color;
+  }
+
+  uint32_t newIndex = bg.CycledPaletteIndex(paletteIndex);
+
+  return PackRGBA32(bg.PaletteColorByIndex[newIndex]);
+}
+
+// =============================================================================
+
+//
+// Per-pixel palette resolve as it was before palette kernels.
+//
+void GatherAnimatedModulo(const BgImage& bg,
+                          const OffsetTables& tables,
+                          uint32_t* dst)
+{
+  for (uint32_t y = 0; y < bg.Height; y++)
+  {
+    const uint16_t  iy      = tables.SourceRow[y];
+    const uint16_t* columns = tables.Columns(y);
+
+    for (uint32_t x = 0; x < bg.Width; x++)
+    {
+      *dst++ = ResolvePixelModulo(bg, (size_t)iy * bg.Width + columns[x]);
+    }
+  }
+}
+
+// =============================================================================
+
+//
+// Original ProcessStatic() / ProcessAnimated() loop: offset computed,
+// wrapped and resolved for every pixel as it goes, with angles accumulated
+// per pixel. Only difference is that angles are 16.16 phases with sine LUT
+// instead of doubles with std::sin(), because that's a deliberate change
+// of the formula (see BenchSineVsLut()), not of how the frame is put
+// together.
+//
+// phaseX, phaseY and offsetY are carried over between frames by the caller,
+// the way the loop kept them in globals.
+//
+void RenderPerPixel(const BgImage& bg,
+                    uint32_t phaseIncX,
+                    uint32_t phaseIncY,
+                    uint32_t& phaseX,
+                    uint32_t& phaseY,
+                    int& offsetY,
+                    uint32_t* dst)
+{
+  const int32_t factorX = ToFixed(bg.ScanlineFactorX);
+  const int32_t factorY = ToFixed(bg.ScanlineFactorY);
+
+  auto Wrap = [](int64_t coord, uint32_t size)
+  {
+    int64_t res = coord % (int64_t)size;
+    return (size_t)((res < 0) ? res + size : res);
+  };
+
+  for (uint32_t y = 0; y < bg.Height; y++)
+  {
+    size_t iy = Wrap((int64_t)y + bg.ScrollPosY + offsetY, bg.Height);
+
+    for (uint32_t x = 0; x < bg.Width; x++)
+    {
+      int offsetX = FixedMulToInt(SineFixed(phaseX), factorX);
+      if (offsetX < 0)
+      {
+        offsetX += (bg.Width - 1);
+      }
+
+      size_t ix = Wrap((int64_t)x + bg.ScrollPosX + offsetX, bg.Width);
+
+      *dst++ = ResolvePixelModulo(bg, iy * bg.Width + ix);
+
+      phaseX += phaseIncX;
+      phaseY += phaseIncY;
+    }
+
+    offsetY = FixedMulToInt(SineFixed(phaseY), factorY);
+    if (offsetY < 0)
+    {
+      offsetY += (bg.Height - 1);
+    }
+  }
+}
+
+// =============================================================================
+
+std::vector<std::string> ListBackgrounds()
+{
+  //
+  // Because directory_iterator doesn't sort.
+  //
+  std::set<std::string> files;
+
+  std::filesystem::path p{"bg"};
+
+  if (not std::filesystem::is_directory(p))
+  {
+    printf("'bg' folder is not present - run from project root!\n");
+    return {};
+  }
+
+  for (auto& item : std::filesystem::directory_iterator(p))
+  {
+    if (item.path().extension() == ".bmp")
+    {
+      files.insert(item.path().string());
+    }
+  }
+
+  return std::vector<std::string>(files.begin(), files.end());
+}
+
+// =============================================================================
+
+std::vector<std::unique_ptr<BgImage>> LoadAllBackgrounds()
+{
+  ThreadPool pool;
+
+  return LoadImages(ListBackgrounds(), pool);
+}
+
+// =============================================================================
+
+//
+// Loading is dominated by file IO on the first run, so every variant is
+// repeated and the best time is reported, which is the warm cache case.
+//
+void BenchLoading()
+{
+  const size_t kRuns = 5;
+
+  std::vector<std::string> files = ListBackgrounds();
+
+  printf("--- background loading (%zu files, best of %zu) ---\n",
+         files.size(), kRuns);
+
+  auto Run = [&files](ThreadPool& pool)
+  {
+    double best = 0.0;
+
+    for (size_t i = 0; i < kRuns; i++)
+    {
+      Clock::time_point t0 = Clock::now();
+      auto images = LoadImages(files, pool);
+      std::chrono::duration<double> dt = Clock::now() - t0;
+
+      Sink += images.size();
+
+      if (i == 0 or dt.count() < best)
+      {
+        best = dt.count();
+      }
+    }
+
+    return best;
+  };
+
+  ThreadPool serialPool(1);
+  ThreadPool parallelPool;
+
+  double serial   = Run(serialPool);
+  double parallel = Run(parallelPool);
+
+  printf("%-32s %10.2f ms\n", "serial", serial * 1e3);
+  printf("%-32s %10.2f ms (%zu threads, x%.2f)\n",
+         "parallel",
+         parallel * 1e3,
+         parallelPool.ThreadsCount(),
+         serial / parallel);
+}
+
+// =============================================================================
+
+void BenchPaletteKernels(size_t frames)
+{
+  printf("--- palette resolve kernels (%zu frames) ---\n", frames);
+
+  auto backgrounds = LoadAllBackgrounds();
+
+  std::unique_ptr<OffsetTables> tables = std::make_unique<OffsetTables>();
+
+  std::vector<uint32_t> reference;
+  std::vector<uint32_t> out;
+
+  for (auto& bg : backgrounds)
+  {
+    const size_t framePixels = (size_t)bg->Width * bg->Height;
+
+    reference.assign(framePixels, 0);
+    out.assign(framePixels, 0);
+
+    bg->ScrollPosX = 17;
+    bg->ScrollPosY = 5;
+    bg->ScanlineFactorX = 8.5;
+    bg->ScanlineFactorY = 3.25;
+
+    BuildOffsetTables(*bg,
+                      DegreesToPhase(0.05),
+                      DegreesToPhase(0.37),
+                      *tables);
+
+    std::string name = std::filesystem::path(bg->Fname).stem().string();
+
+    printf("%s (%ux%u, %zu palette colors, %s, %zu KiB)\n",
+           name.data(),
+           bg->Width,
+           bg->Height,
+           bg->PaletteColorByIndex.size(),
+           bg->IsIndexed() ? "indexed" : "true color",
+           bg->MemoryUsed() / 1024);
+
+    Clock::time_point tp = Clock::now();
+
+    for (size_t i = 0; i < frames; i++)
+    {
+      bg->CyclePalette();
+
+      GatherAnimatedModulo(*bg, *tables, reference.data());
+      Sink += reference[i % reference.size()];
+    }
+
+    Report("  modulo + branch",
+           frames,
+           framePixels,
+           std::chrono::duration<double>(Clock::now() - tp).count());
+
+    for (size_t k = 0; k < (size_t)PaletteKernelType::LAST_ELEMENT; k++)
+    {
+      PaletteKernelType type = (PaletteKernelType)k;
+
+      if (not IsPaletteKernelSupported(type))
+      {
+        continue;
+      }
+
+      PaletteKernel kernel = GetPaletteKernel(type);
+
+      tp = Clock::now();
+
+      for (size_t i = 0; i < frames; i++)
+      {
+        bg->CyclePalette();
+
+        Gather(*bg, *tables, out.data(), kernel);
+        Sink += out[i % out.size()];
+      }
+
+      double seconds = std::chrono::duration<double>(Clock::now() - tp).count();
+
+      //
+      // Both ran the same last frame, so they must match.
+      //
+      GatherAnimatedModulo(*bg, *tables, reference.data());
+
+      std::string label = std::string("  ") + PaletteKernelName(type);
+
+      if (out != reference)
+      {
+        label += " (MISMATCH!)";
+      }
+
+      Report(label.data(), frames, framePixels, seconds);
+    }
+  }
+}
+
+// =============================================================================
+
+//
+// Row band rendering on pools of different size. Every pool renders the same
+// sequence of frames as serial BuildOffsetTables() + Gather(), and output
+// of every frame is checked against it.
+//
+void BenchParallel(size_t frames)
+{
+  std::vector<size_t> threadCounts = { 1, 2, 4 };
+
+  size_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  if (std::find(threadCounts.begin(),
+                threadCounts.end(),
+                hardwareThreads) == threadCounts.end())
+  {
+    threadCounts.push_back(hardwareThreads);
+  }
+
+  printf("--- row band rendering (%zu frames, %zu hardware threads) ---\n",
+         frames, hardwareThreads);
+
+  auto backgrounds = LoadAllBackgrounds();
+  if (backgrounds.empty())
+  {
+    return;
+  }
+
+  BgImage& bg = *backgrounds.front();
+
+  const size_t framePixels = (size_t)bg.Width * bg.Height;
+
+  std::unique_ptr<OffsetTables> tables = std::make_unique<OffsetTables>();
+
+  std::vector<uint32_t> reference(framePixels);
+  std::vector<uint32_t> out(framePixels);
+
+  const uint32_t phaseIncX = DegreesToPhase(0.05);
+  const uint32_t phaseIncY = DegreesToPhase(0.37);
+
+  auto Setup = [](BgImage& img)
+  {
+    img.ResetParams();
+    img.PhaseX = 0;
+    img.PhaseY = 0;
+    img.ScrollSpeedH = 1;
+    img.ScrollSpeedV = -1;
+    img.ScanlineFactorX = 8.5;
+    img.ScanlineFactorY = 3.25;
+  };
+
+  Setup(bg);
+
+  Clock::time_point tp = Clock::now();
+
+  for (size_t i = 0; i < frames; i++)
+  {
+    BuildOffsetTables(bg, phaseIncX, phaseIncY, *tables);
+    Gather(bg, *tables, out.data());
+    AdvanceBackground(bg, phaseIncX, phaseIncY, bg.Width, bg.Height, kFrameTime);
+    Sink += out[i % out.size()];
+  }
+
+  Report("serial",
+         frames,
+         framePixels,
+         std::chrono::duration<double>(Clock::now() - tp).count());
+
+  for (size_t threads : threadCounts)
+  {
+    ThreadPool pool(threads);
+
+    Setup(bg);
+
+    tp = Clock::now();
+
+    for (size_t i = 0; i < frames; i++)
+    {
+      RenderParallel(bg, phaseIncX, phaseIncY, *tables, out.data(), pool);
+      AdvanceBackground(bg, phaseIncX, phaseIncY, bg.Width, bg.Height, kFrameTime);
+      Sink += out[i % out.size()];
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - tp).count();
+
+    //
+    // Check frame by frame on a separate run, so that comparison is not
+    // included in the timing.
+    //
+    bool match = true;
+
+    Setup(bg);
+
+    std::unique_ptr<BgImage> ref = std::make_unique<BgImage>(bg);
+
+    for (size_t i = 0; i < std::min(frames, (size_t)64) and match; i++)
+    {
+      BuildOffsetTables(*ref, phaseIncX, phaseIncY, *tables);
+      Gather(*ref, *tables, reference.data());
+
+      RenderParallel(bg, phaseIncX, phaseIncY, *tables, out.data(), pool);
+
+      match = (out == reference);
+
+      AdvanceBackground(*ref, phaseIncX, phaseIncY, ref->Width, ref->Height, kFrameTime);
+      AdvanceBackground(bg,   phaseIncX, phaseIncY, bg.Width,   bg.Height,   kFrameTime);
+    }
+
+    std::string label = std::to_string(threads) + " threads";
+
+    if (not match)
+    {
+      label += " (MISMATCH!)";
+    }
+
+    Report(label.data(), frames, framePixels, seconds);
+  }
+}
+
+// =============================================================================
+
+//
+// Two 256x256 layers on one thread, which is what the app does with second
+// layer enabled. "separate passes" is the straightforward way for
+// comparison: render every layer into its own buffer, then blend them.
+//
+void BenchCompositor(size_t frames)
+{
+  const double kFrameBudgetNs = 1e9 / 60.0;
+
+  printf("--- two layer compositing, one thread (%zu frames) ---\n", frames);
+
+  auto backgrounds = LoadAllBackgrounds();
+  if (backgrounds.size() < 2)
+  {
+    printf("Need at least two backgrounds!\n");
+    return;
+  }
+
+  const uint32_t width  = backgrounds[0]->Width;
+  const uint32_t height = backgrounds[0]->Height;
+
+  const size_t framePixels = (size_t)width * height;
+
+  ThreadPool pool(1);
+
+  std::vector<BgLayer> layers(2);
+
+  for (size_t i = 0; i < layers.size(); i++)
+  {
+    BgImage& bg = *backgrounds[i];
+
+    bg.ResetParams();
+    bg.ScanlineFactorX = 8.5 + i;
+    bg.ScanlineFactorY = 3.25 + i;
+
+    layers[i].Image     = &bg;
+    layers[i].PhaseIncX = DegreesToPhase(0.05 + 0.1 * i);
+    layers[i].PhaseIncY = DegreesToPhase(0.37 - 0.1 * i);
+  }
+
+  std::vector<uint32_t> out(framePixels);
+
+  auto AdvanceLayers = [&]()
+  {
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+      AdvanceBackground(*backgrounds[i],
+                        layers[i].PhaseIncX,
+                        layers[i].PhaseIncY,
+                        width,
+                        height,
+                        kFrameTime);
+    }
+  };
+
+  auto ReportWithBudget = [&](std::string name, double seconds)
+  {
+    double nsPerFrame = seconds * 1e9 / (double)frames;
+
+    char budget[64];
+    std::snprintf(budget, sizeof(budget),
+                  " (%.1f%% of 60 fps)", nsPerFrame / kFrameBudgetNs * 100.0);
+
+    name += budget;
+
+    Report(name.data(), frames, framePixels, seconds);
+  };
+
+  {
+    std::vector<uint32_t> layerPixels(framePixels);
+
+    Clock::time_point tp = Clock::now();
+
+    for (size_t i = 0; i < frames; i++)
+    {
+      RenderParallel(*layers[0].Image,
+                     layers[0].PhaseIncX,
+                     layers[0].PhaseIncY,
+                     layers[0].Tables,
+                     out.data(),
+                     pool);
+
+      RenderParallel(*layers[1].Image,
+                     layers[1].PhaseIncX,
+                     layers[1].PhaseIncY,
+                     layers[1].Tables,
+                     layerPixels.data(),
+                     pool);
+
+      for (size_t p = 0; p < framePixels; p++)
+      {
+        const uint8_t* a = (const uint8_t*)&out[p];
+        const uint8_t* b = (const uint8_t*)&layerPixels[p];
+
+        uint8_t* o = (uint8_t*)&out[p];
+
+        for (size_t c = 0; c < 4; c++)
+        {
+          o[c] = (a[c] + b[c]) / 2;
+        }
+      }
+
+      AdvanceLayers();
+
+      Sink += out[i % framePixels];
+    }
+
+    ReportWithBudget("separate passes, average",
+                     std::chrono::duration<double>(Clock::now() - tp).count());
+  }
+
+  for (size_t m = 0; m < (size_t)BlendMode::LAST_ELEMENT; m++)
+  {
+    BlendMode mode = (BlendMode)m;
+
+    Clock::time_point tp = Clock::now();
+
+    for (size_t i = 0; i < frames; i++)
+    {
+      CompositeLayers(layers, mode, width, height, out.data(), pool);
+      AdvanceLayers();
+
+      Sink += out[i % framePixels];
+    }
+
+    ReportWithBudget(std::string("single pass, ") + BlendModeName(mode),
+                     std::chrono::duration<double>(Clock::now() - tp).count());
+  }
+}
+
+// =============================================================================
+
+//
+// Per frame timings of the whole CPU side of a frame, the same thing main
+// loop and headless mode do: BuildOffsetTables(), Gather() and
+// AdvanceBackground().
+//
+struct FrameStats
+{
+  std::string Background;
+  std::string Mode;
+
+  size_t Frames = 0;
+
+  double MeanNs = 0.0;
+  double P50Ns  = 0.0;
+  double P90Ns  = 0.0;
+  double P99Ns  = 0.0;
+  double MaxNs  = 0.0;
+
+  double PixelsPerSec = 0.0;
+};
+
+// =============================================================================
+
+//
+// Nearest rank on already sorted values.
+//
+double Percentile(const std::vector<double>& sorted, double p)
+{
+  size_t rank = (size_t)std::ceil(p / 100.0 * (double)sorted.size());
+
+  return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+// =============================================================================
+
+FrameStats MeasureFrames(BgImage& bg,
+                         const char* mode,
+                         double angleIncreaseX,
+                         double angleIncreaseY,
+                         size_t frames)
+{
+  const size_t kWarmupFrames = 16;
+
+  std::unique_ptr<OffsetTables> tables = std::make_unique<OffsetTables>();
+
+  std::vector<uint32_t> out((size_t)bg.Width * bg.Height);
+
+  const uint32_t phaseIncX = DegreesToPhase(angleIncreaseX);
+  const uint32_t phaseIncY = DegreesToPhase(angleIncreaseY);
+
+  std::vector<double> times;
+  times.reserve(frames);
+
+  for (size_t i = 0; i < kWarmupFrames + frames; i++)
+  {
+    Clock::time_point tp = Clock::now();
+
+    BuildOffsetTables(bg, phaseIncX, phaseIncY, *tables);
+    Gather(bg, *tables, out.data());
+    AdvanceBackground(bg, phaseIncX, phaseIncY, bg.Width, bg.Height, kFrameTime);
+
+    Clock::duration dt = Clock::now() - tp;
+
+    Sink += out[i % out.size()];
+
+    if (i >= kWarmupFrames)
+    {
+      times.push_back(std::chrono::duration<double, std::nano>(dt).count());
+    }
+  }
+
+  FrameStats res;
+
+  res.Background = std::filesystem::path(bg.Fname).stem().string();
+  res.Mode       = mode;
+  res.Frames     = frames;
+
+  if (times.empty())
+  {
+    return res;
+  }
+
+  double total = 0.0;
+
+  for (double t : times)
+  {
+    total += t;
+  }
+
+  std::sort(times.begin(), times.end());
+
+  res.MeanNs = total / (double)times.size();
+  res.P50Ns  = Percentile(times, 50.0);
+  res.P90Ns  = Percentile(times, 90.0);
+  res.P99Ns  = Percentile(times, 99.0);
+  res.MaxNs  = times.back();
+
+  res.PixelsPerSec = (double)bg.Width * bg.Height / (res.MeanNs * 1e-9);
+
+  return res;
+}
+
+// =============================================================================
+
+//
+// "static" is background as is, with all parameters reset.
+// "animated" is parameters randomized the same way 'R' does, with RNG
+// reseeded before every background, so every background gets the same
+// parameters regardless of what else is in bg folder.
+//
+std::vector<FrameStats> BenchFrames(size_t frames, uint64_t seed)
+{
+  printf("--- full frame (%zu frames, seed %llu) ---\n",
+         frames, (unsigned long long)seed);
+
+  printf("%-24s %12s %12s %12s %12s %12s %10s\n",
+         "", "mean ns", "p50 ns", "p90 ns", "p99 ns", "max ns", "Mpx/s");
+
+  std::vector<FrameStats> res;
+
+  auto backgrounds = LoadAllBackgrounds();
+
+  for (auto& bg : backgrounds)
+  {
+    bg->ResetParams();
+
+    res.push_back(MeasureFrames(*bg, "static", 0.0, 0.0, frames));
+
+    RNG.seed(seed);
+
+    double angleIncreaseX = ::Random01();
+    double angleIncreaseY = ::Random01();
+
+    bg->RandomizeParams();
+
+    res.push_back(MeasureFrames(*bg,
+                                "animated",
+                                angleIncreaseX,
+                                angleIncreaseY,
+                                frames));
+  }
+
+  for (const FrameStats& fs : res)
+  {
+    std::string name = fs.Background + " " + fs.Mode;
+
+    printf("%-24s %12.0f %12.0f %12.0f %12.0f %12.0f %10.1f\n",
+           name.data(),
+           fs.MeanNs, fs.P50Ns, fs.P90Ns, fs.P99Ns, fs.MaxNs,
+           fs.PixelsPerSec / 1e6);
+  }
+
+  return res;
+}
+
+// =============================================================================
+
+//
+// "-" means stdout.
+//
+FILE* OpenOutput(const std::string& fname)
+{
+  if (fname == "-")
+  {
+    return stdout;
+  }
+
+  FILE* f = std::fopen(fname.data(), "w");
+  if (f == nullptr)
+  {
+    printf("Failed to open '%s' for writing!\n", fname.data());
+  }
+
+  return f;
+}
+
+// =============================================================================
+
+void CloseOutput(FILE* f)
+{
+  if (f != nullptr and f != stdout)
+  {
+    std::fclose(f);
+  }
+}
+
+// =============================================================================
+
+void WriteCSV(const std::vector<FrameStats>& stats, const std::string& fname)
+{
+  FILE* f = OpenOutput(fname);
+  if (f == nullptr)
+  {
+    return;
+  }
+
+  fprintf(f, "background,mode,frames,mean_ns,p50_ns,p90_ns,p99_ns,max_ns,"
+             "pixels_per_sec\n");
+
+  for (const FrameStats& fs : stats)
+  {
+    fprintf(f, "%s,%s,%zu,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f\n",
+            fs.Background.data(), fs.Mode.data(), fs.Frames,
+            fs.MeanNs, fs.P50Ns, fs.P90Ns, fs.P99Ns, fs.MaxNs,
+            fs.PixelsPerSec);
+  }
+
+  CloseOutput(f);
+}
+
+// =============================================================================
+
+void WriteJSON(const std::vector<FrameStats>& stats,
+               const std::string& fname,
+               uint64_t seed)
+{
+  FILE* f = OpenOutput(fname);
+  if (f == nullptr)
+  {
+    return;
+  }
+
+  auto Escaped = [](const std::string& str)
+  {
+    std::string res;
+
+    for (char c : str)
+    {
+      if (c == '"' or c == '\\')
+      {
+        res += '\\';
+      }
+
+      res += c;
+    }
+
+    return res;
+  };
+
+  fprintf(f, "{\n  \"seed\": %llu,\n  \"results\": [\n",
+          (unsigned long long)seed);
+
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    const FrameStats& fs = stats[i];
+
+    fprintf(f, "    { \"background\": \"%s\", \"mode\": \"%s\", "
+               "\"frames\": %zu, \"mean_ns\": %.0f, \"p50_ns\": %.0f, "
+               "\"p90_ns\": %.0f, \"p99_ns\": %.0f, \"max_ns\": %.0f, "
+               "\"pixels_per_sec\": %.0f }%s\n",
+            Escaped(fs.Background).data(), fs.Mode.data(), fs.Frames,
+            fs.MeanNs, fs.P50Ns, fs.P90Ns, fs.P99Ns, fs.MaxNs,
+            fs.PixelsPerSec,
+            (i + 1 < stats.size()) ? "," : "");
+  }
+
+  fprintf(f, "  ]\n}\n");
+
+  CloseOutput(f);
+}
+
+// =============================================================================
+
+//
+// Original per pixel effect against every per scanline distortion type,
+// table build and gather together, on one thread.
+//
+void BenchDistortion(size_t frames)
+{
+  printf("--- distortion types, one thread (%zu frames) ---\n", frames);
+
+  auto backgrounds = LoadAllBackgrounds();
+  if (backgrounds.empty())
+  {
+    printf("No backgrounds!\n");
+    return;
+  }
+
+  BgImage& bg = *backgrounds[0];
+
+  const size_t framePixels = (size_t)bg.Width * bg.Height;
+
+  ThreadPool pool(1);
+
+  std::unique_ptr<OffsetTables> tables = std::make_unique<OffsetTables>();
+
+  std::vector<uint32_t> out(framePixels);
+
+  for (size_t t = 0; t < (size_t)DistortionType::LAST_ELEMENT; t++)
+  {
+    bg.ResetParams();
+    bg.ScanlineFactorX = 8.5;
+    bg.ScanlineFactorY = 3.25;
+
+    bg.CurrentDistortion.Type        = (DistortionType)t;
+    bg.CurrentDistortion.Compression = 0.5;
+
+    Clock::time_point tp = Clock::now();
+
+    for (size_t i = 0; i < frames; i++)
+    {
+      RenderParallel(bg,
+                     DegreesToPhase(0.05),
+                     DegreesToPhase(0.37),
+                     *tables,
+                     out.data(),
+                     pool);
+
+      AdvanceBackground(bg,
+                        DegreesToPhase(0.05),
+                        DegreesToPhase(0.37),
+                        bg.Width,
+                        bg.Height,
+                        kFrameTime);
+
+      Sink += out[i % framePixels];
+    }
+
+    Report(DistortionTypeName((DistortionType)t),
+           frames,
+           framePixels,
+           std::chrono::duration<double>(Clock::now() - tp).count());
+  }
+}
+
+// =============================================================================
+
+//
+// NRS parsing as it was before the single pass parser: whitespace stripped
+// copy of the text made through stringstream, state machine run over it
+// char by char, then another stripped copy parsed into the tree with more
+// stringstreams.
+//
+std::string LegacyNrsOneliner(const std::string& text)
+{
+  const std::string unwanted = " \t\n\r\f\v";
+
+  std::stringstream ss;
+
+  bool inQuotes = false;
+
+  for (auto& c : text)
+  {
+    bool unwantedFound = std::find(unwanted.begin(),
+                                   unwanted.end(),
+                                   c) != unwanted.end();
+
+    if (c == '\"')
+    {
+      inQuotes = not inQuotes;
+    }
+
+    if (inQuotes or not unwantedFound)
+    {
+      ss << c;
+    }
+  }
+
+  return ss.str();
+}
+
+// =============================================================================
+
+bool LegacyNrsCheckSyntax(const std::string& text)
+{
+  enum class State
+  {
+    UNDEFINED,
+    READING_KEY,
+    KEY_DONE,
+    READING_VALUE,
+    VALUE_DONE,
+    READING_VALUE_Q,
+    VALUE_Q_DONE,
+    READING_LIST,
+    READING_OBJECT,
+    OBJECT_DONE,
+    ERROR
+  };
+
+  const std::set<char> transitionChars = { ':', '{', '}', ',', '"', '/' };
+
+  auto IsValidChar = [&transitionChars](const char c)
+  {
+    return (c > 32 and c < 127 and transitionChars.count(c) == 0);
+  };
+
+  State state = State::UNDEFINED;
+
+  size_t scopeCount = 0;
+
+  std::string oneliner = LegacyNrsOneliner(text);
+
+  for (auto& c : oneliner)
+  {
+    switch (state)
+    {
+      case State::UNDEFINED:
+      case State::READING_KEY:
+        if (c == ':' and state == State::READING_KEY)
+        {
+          state = State::KEY_DONE;
+        }
+        else
+        {
+          state = IsValidChar(c) ? State::READING_KEY : State::ERROR;
+        }
+        break;
+
+      case State::KEY_DONE:
+        if (c == '\"')
+        {
+          state = State::READING_VALUE_Q;
+        }
+        else if (c == '{')
+        {
+          scopeCount++;
+          state = State::READING_OBJECT;
+        }
+        else
+        {
+          state = IsValidChar(c) ? State::READING_VALUE : State::ERROR;
+        }
+        break;
+
+      case State::READING_VALUE:
+        if (c == ',')
+        {
+          state = State::VALUE_DONE;
+        }
+        else if (c == '/')
+        {
+          state = State::READING_LIST;
+        }
+        else if (not IsValidChar(c))
+        {
+          state = State::ERROR;
+        }
+        break;
+
+      case State::VALUE_DONE:
+      case State::READING_OBJECT:
+        if (c == '}')
+        {
+          if (scopeCount > 0)
+          {
+            scopeCount--;
+            state = State::OBJECT_DONE;
+          }
+          else
+          {
+            state = State::ERROR;
+          }
+        }
+        else
+        {
+          state = IsValidChar(c) ? State::READING_KEY : State::ERROR;
+        }
+        break;
+
+      case State::OBJECT_DONE:
+        state = (c == ',') ? State::VALUE_DONE : State::ERROR;
+        break;
+
+      case State::READING_VALUE_Q:
+        if (c == '\"')
+        {
+          state = State::VALUE_Q_DONE;
+        }
+        break;
+
+      case State::VALUE_Q_DONE:
+        if (c == ',')
+        {
+          state = State::VALUE_DONE;
+        }
+        else if (c == '/')
+        {
+          state = State::READING_LIST;
+        }
+        else
+        {
+          state = State::ERROR;
+        }
+        break;
+
+      case State::READING_LIST:
+        if (c == '\"')
+        {
+          state = State::READING_VALUE_Q;
+        }
+        else
+        {
+          state = IsValidChar(c) ? State::READING_VALUE : State::ERROR;
+        }
+        break;
+
+      default:
+        break;
+    }
+
+    if (state == State::ERROR)
+    {
+      break;
+    }
+  }
+
+  return (state == State::VALUE_DONE and scopeCount == 0);
+}
+
+// =============================================================================
+
+//
+// NRS node as it was before arena: every node owns its values, children
+// and name index, plus a few per node constants. Only what LegacyNrsBuild()
+// and LegacyNrsWrite() need is implemented.
+//
+struct LegacyNrsNode
+{
+  std::vector<std::string> Content;
+
+  std::vector<std::pair<std::string, LegacyNrsNode>> Children;
+
+  std::unordered_map<std::string, size_t> ChildIndexByName;
+
+  size_t CurrentIndent = 0;
+
+  const std::string kEmptyString;
+
+  const std::string UnwantedCharacters = " \t\n\r\f\v";
+
+  size_t ParsingScopeCount = 0;
+
+  int ParsingState = -1;
+
+  const std::set<char> TransitionChars = { ':', '{', '}', ',', '"', '/' };
+
+  // ---------------------------------------------------------------------------
+
+  void SetString(const std::string& s, size_t index)
+  {
+    if (Content.size() <= index)
+    {
+      Content.resize(index + 1);
+    }
+
+    Content[index] = s;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  LegacyNrsNode& operator[](const std::string& nodeName)
+  {
+    if (ChildIndexByName.count(nodeName) == 0)
+    {
+      ChildIndexByName[nodeName] = Children.size();
+
+      Children.push_back({ nodeName, LegacyNrsNode() });
+    }
+
+    return Children[ChildIndexByName[nodeName]].second;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void Clear()
+  {
+    Content.clear();
+    Children.clear();
+    ChildIndexByName.clear();
+  }
+};
+
+// =============================================================================
+
+//
+// Same output as NRS::ToStringObject(), to check that both parsers build
+// the same tree.
+//
+void LegacyNrsWrite(const LegacyNrsNode& node, std::stringstream& ss)
+{
+  for (auto& item : node.Children)
+  {
+    if (not item.second.Children.empty())
+    {
+      ss << item.first << ":{";
+      LegacyNrsWrite(item.second, ss);
+      ss << "},";
+      continue;
+    }
+
+    const std::vector<std::string>& values = item.second.Content;
+
+    if (values.empty())
+    {
+      ss << item.first << ":{},";
+      continue;
+    }
+
+    ss << item.first << ":";
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+      const std::string& str = values[i];
+
+      bool quoted = (str.empty() or str.find_first_of("/ ,") != std::string::npos);
+
+      ss << (quoted ? "\"" : "") << str << (quoted ? "\"" : "")
+         << ((i + 1 < values.size()) ? "/" : "");
+    }
+
+    ss << ",";
+  }
+}
+
+// =============================================================================
+
+void LegacyNrsBuild(LegacyNrsNode& root, const std::string& text)
+{
+  root.Clear();
+
+  std::string oneliner = LegacyNrsOneliner(text);
+
+  std::string key;
+  std::string value;
+
+  std::vector<LegacyNrsNode*> tree;
+  tree.push_back(&root);
+
+  bool inQuotesTop = false;
+
+  std::stringstream ss;
+
+  for (auto& c : oneliner)
+  {
+    switch (c)
+    {
+      case '\"':
+        inQuotesTop = not inQuotesTop;
+        ss << c;
+        break;
+
+      case ':':
+        key = ss.str();
+        ss.str(std::string());
+        break;
+
+      case ',':
+      {
+        if (inQuotesTop)
+        {
+          ss << c;
+          break;
+        }
+
+        value = ss.str();
+
+        bool inQuotes  = false;
+        bool listFound = false;
+
+        std::string valueItem;
+
+        size_t valueIndex = 0;
+
+        for (auto& ch : value)
+        {
+          if (ch == '\"')
+          {
+            inQuotes = not inQuotes;
+          }
+          else if (ch == '/' and not inQuotes)
+          {
+            listFound = true;
+
+            (*tree.back())[key].SetString(valueItem, valueIndex);
+            valueIndex++;
+            valueItem.clear();
+          }
+          else
+          {
+            valueItem.append(1, ch);
+          }
+        }
+
+        if (listFound or not valueItem.empty())
+        {
+          (*tree.back())[key].SetString(valueItem, valueIndex);
+        }
+
+        ss.str(std::string());
+      }
+      break;
+
+      case '{':
+        tree.push_back(&(*tree.back())[key]);
+        ss.str(std::string());
+        break;
+
+      case '}':
+        tree.pop_back();
+        ss.str(std::string());
+        break;
+
+      default:
+        ss << c;
+        break;
+    }
+  }
+}
+
+// =============================================================================
+
+//
+// Formatted like background data files, with objects, lists and quoted
+// strings, repeated until it's about targetSize bytes.
+//
+std::string MakeSyntheticNrs(size_t targetSize)
+{
+  std::string text;
+  text.reserve(targetSize + 1024);
+
+  char buf[128];
+
+  for (size_t i = 0; text.size() < targetSize; i++)
+  {
+    snprintf(buf, sizeof(buf), "object%zu : {\n", i);
+    text += buf;
+
+    snprintf(buf, sizeof(buf), "  name : \"Dummy Actor %zu\",\n", i);
+    text += buf;
+
+    snprintf(buf, sizeof(buf), "  hitpoints : %zu,\n", i % 1000);
+    text += buf;
+
+    text += "  colors : {\n";
+
+    for (size_t j = 1; j <= 16; j++)
+    {
+      snprintf(buf, sizeof(buf), "    %zu : %zu/%zu/%zu,\n",
+               j, (i + j) % 256, (i * j) % 256, (i + 7 * j) % 256);
+      text += buf;
+    }
+
+    text += "  },\n";
+    text += "  inventory : item1/item2/\"it,e/m\",\n";
+    text += "  empty : {},\n";
+    text += "},\n";
+  }
+
+  return text;
+}
+
+// =============================================================================
+
+//
+// Parse throughput of the single pass NRS parser against the legacy one,
+// best of several runs, and a check that both build the same tree.
+//
+void BenchNrs()
+{
+  const size_t kRuns = 5;
+
+  printf("--- NRS parsing (best of %zu) ---\n", kRuns);
+
+  for (size_t size : { (size_t)64 * 1024, (size_t)8 * 1024 * 1024 })
+  {
+    std::string text = MakeSyntheticNrs(size);
+
+    const double mb = (double)text.size() / (1024.0 * 1024.0);
+
+    LegacyNrsNode legacy;
+    NRS current;
+
+    auto Run = [&text](const std::function<void()>& fn)
+    {
+      double best = 0.0;
+
+      for (size_t i = 0; i < kRuns; i++)
+      {
+        Clock::time_point t0 = Clock::now();
+        fn();
+        std::chrono::duration<double> dt = Clock::now() - t0;
+
+        if (i == 0 or dt.count() < best)
+        {
+          best = dt.count();
+        }
+      }
+
+      return best;
+    };
+
+    double legacyTime = Run([&]()
+    {
+      if (LegacyNrsCheckSyntax(text))
+      {
+        LegacyNrsBuild(legacy, text);
+      }
+    });
+
+    double currentTime = Run([&]()
+    {
+      Sink += current.FromStringObject(text);
+    });
+
+    //
+    // Syntax check alone shows the parser itself without tree building.
+    //
+    double legacyCheckTime = Run([&]()
+    {
+      Sink += LegacyNrsCheckSyntax(text);
+    });
+
+    double currentCheckTime = Run([&]()
+    {
+      Sink += current.CheckSyntax(text);
+    });
+
+    std::stringstream legacyOut;
+    LegacyNrsWrite(legacy, legacyOut);
+
+    bool same = (legacyOut.str() == current.ToStringObject());
+
+    char name[64];
+
+    snprintf(name, sizeof(name), "legacy, %.2f MB", mb);
+    printf("%-32s %10.2f ms %10.1f MB/s\n",
+           name, legacyTime * 1e3, mb / legacyTime);
+
+    snprintf(name, sizeof(name), "single pass, %.2f MB", mb);
+    printf("%-32s %10.2f ms %10.1f MB/s (x%.2f)%s\n",
+           name,
+           currentTime * 1e3,
+           mb / currentTime,
+           legacyTime / currentTime,
+           same ? "" : " MISMATCH!");
+
+    snprintf(name, sizeof(name), "legacy check, %.2f MB", mb);
+    printf("%-32s %10.2f ms %10.1f MB/s\n",
+           name, legacyCheckTime * 1e3, mb / legacyCheckTime);
+
+    snprintf(name, sizeof(name), "single pass check, %.2f MB", mb);
+    printf("%-32s %10.2f ms %10.1f MB/s (x%.2f)\n",
+           name,
+           currentCheckTime * 1e3,
+           mb / currentCheckTime,
+           legacyCheckTime / currentCheckTime);
+  }
+}
+
+// =============================================================================
+
+//
+// File reading as NRS::Load() did it before memory mapping: size from
+// seekg, read into a buffer, appended into stringstream and copied out.
+//
+std::string LegacyNrsReadFile(const std::string& fname)
+{
+  std::stringstream ss;
+
+  std::ifstream file(fname, std::ios::binary | std::ios::ate);
+  if (not file.is_open())
+  {
+    return std::string();
+  }
+
+  file.seekg(0, std::ios::end);
+  auto fsize = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  std::string buf(fsize, '\0');
+
+  while (file.read(&buf[0], fsize))
+  {
+    ss << buf;
+  }
+
+  return ss.str();
+}
+
+// =============================================================================
+
+//
+// Reading of a large file alone (every byte is touched, so that mapped
+// pages are actually read in) and whole NRS::Load().
+// File is warm in the page cache after the first run.
+//
+void BenchNrsFileLoading()
+{
+  const size_t kRuns = 5;
+
+  //
+  // Legacy load takes seconds.
+  //
+  const size_t kLoadRuns = 2;
+
+  const size_t kSize = 32 * 1024 * 1024;
+
+  std::string fname = (std::filesystem::temp_directory_path()
+                       / "earthbound-bgfx-nrs-bench.txt").string();
+
+  {
+    std::string text = MakeSyntheticNrs(kSize);
+
+    std::ofstream out(fname, std::ios::binary);
+    out.write(text.data(), text.size());
+
+    if (not out)
+    {
+      printf("Failed to write '%s'!\n", fname.data());
+      return;
+    }
+  }
+
+  const double mb = (double)std::filesystem::file_size(fname) / (1024.0 * 1024.0);
+
+  printf("--- NRS file loading, %.2f MB (best of %zu, loads best of %zu) ---\n",
+         mb, kRuns, kLoadRuns);
+
+  auto Run = [](const std::function<void()>& fn, size_t runs)
+  {
+    double best = 0.0;
+
+    for (size_t i = 0; i < runs; i++)
+    {
+      Clock::time_point t0 = Clock::now();
+      fn();
+      std::chrono::duration<double> dt = Clock::now() - t0;
+
+      if (i == 0 or dt.count() < best)
+      {
+        best = dt.count();
+      }
+    }
+
+    return best;
+  };
+
+  auto Touch = [](std::string_view data)
+  {
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < data.size(); i += 64)
+    {
+      sum += (uint8_t)data[i];
+    }
+
+    Sink += sum;
+  };
+
+  double legacyRead = Run([&]()
+  {
+    Touch(LegacyNrsReadFile(fname));
+  }, kRuns);
+
+  double mappedRead = Run([&]()
+  {
+    MappedFile file(fname);
+    Touch(file.Data());
+  }, kRuns);
+
+  auto LegacyLoad = [&fname](LegacyNrsNode& n)
+  {
+    std::string text = LegacyNrsReadFile(fname);
+
+    if (LegacyNrsCheckSyntax(text))
+    {
+      LegacyNrsBuild(n, text);
+    }
+  };
+
+  double legacyLoad = Run([&]()
+  {
+    LegacyNrsNode n;
+    LegacyLoad(n);
+  }, kLoadRuns);
+
+  double currentLoad = Run([&]()
+  {
+    NRS n;
+    Sink += (uint32_t)n.Load(fname);
+  }, kLoadRuns);
+
+  //
+  // Heap and RSS used while loading and by the loaded tree itself.
+  // NRS::Load() goes first: where peak RSS can't be reset, it's then
+  // at least right for that one.
+  //
+  HeapUsage legacyHeap;
+  HeapUsage currentHeap;
+
+  RssUsage legacyRss;
+  RssUsage currentRss;
+
+  {
+    NRS n;
+    currentRss = MeasureRss([&]()
+    {
+      currentHeap = MeasureHeap([&]() { n.Load(fname); });
+    });
+  }
+
+  {
+    LegacyNrsNode n;
+    legacyRss = MeasureRss([&]()
+    {
+      legacyHeap = MeasureHeap([&]() { LegacyLoad(n); });
+    });
+  }
+
+  std::filesystem::remove(fname);
+
+  printf("%-32s %10.2f ms %10.1f MB/s\n",
+         "read, legacy", legacyRead * 1e3, mb / legacyRead);
+  printf("%-32s %10.2f ms %10.1f MB/s (x%.2f)\n",
+         "read, mapped",
+         mappedRead * 1e3,
+         mb / mappedRead,
+         legacyRead / mappedRead);
+  printf("%-32s %10.2f ms %10.1f MB/s\n",
+         "load, legacy", legacyLoad * 1e3, mb / legacyLoad);
+  printf("%-32s %10.2f ms %10.1f MB/s (x%.2f)\n",
+         "load, NRS::Load()",
+         currentLoad * 1e3,
+         mb / currentLoad,
+         legacyLoad / currentLoad);
+
+  auto PrintHeap = [](const char* name, const HeapUsage& usage)
+  {
+    printf("%-32s %10zu allocs %8.1f MB peak %8.1f MB tree\n",
+           name,
+           usage.Allocations,
+           usage.PeakBytes / (1024.0 * 1024.0),
+           usage.RetainedBytes / (1024.0 * 1024.0));
+  };
+
+  PrintHeap("heap, legacy", legacyHeap);
+  PrintHeap("heap, NRS::Load()", currentHeap);
+
+  auto PrintRss = [](const char* name, const RssUsage& usage)
+  {
+    printf("%-32s %8.1f MB peak over %8.1f MB before%s\n",
+           name,
+           (usage.Peak - std::min(usage.Peak, usage.Before)) / (1024.0 * 1024.0),
+           usage.Before / (1024.0 * 1024.0),
+           usage.PeakIsOwn ? "" : " (process peak)");
+  };
+
+  PrintRss("rss, NRS::Load()", currentRss);
+  PrintRss("rss, legacy", legacyRss);
+
+  printf("(heap doesn't include %.2f MB file NRS::Load() keeps mapped, rss does)\n",
+         mb);
+}
+
+// =============================================================================
+
+//
+// Reading of a large numeric table: stoll() on a string copy as GetInt()
+// used to do, from_chars() based getters, and the same with number caching
+// on, where every table is read several times.
+//
+void BenchNrsTypedGetters()
+{
+  const size_t kRows   = 100000;
+  const size_t kPasses = 10;
+
+  printf("--- NRS typed getters (%zu rows of 3 values, %zu passes) ---\n",
+         kRows, kPasses);
+
+  std::string text = "table : {\n";
+
+  char buf[64];
+
+  for (size_t i = 0; i < kRows; i++)
+  {
+    snprintf(buf, sizeof(buf), "  %zu : %zu/%zu/%zu,\n",
+             i + 1, i % 256, (i * 7) % 256, (i * 13) % 256);
+    text += buf;
+  }
+
+  text += "},\n";
+
+  NRS doc;
+
+  if (not doc.FromStringObject(text))
+  {
+    printf("Failed to parse!\n");
+    return;
+  }
+
+  NRS& table = doc["table"];
+
+  std::vector<NRS*> rows;
+
+  for (size_t i = 0; i < kRows; i++)
+  {
+    rows.push_back(&table[std::to_string(i + 1)]);
+  }
+
+  auto Run = [&](const char* name, const std::function<uint64_t(NRS&)>& read)
+  {
+    uint64_t sum = 0;
+
+    Clock::time_point t0 = Clock::now();
+
+    HeapUsage usage = MeasureHeap([&]()
+    {
+      for (size_t pass = 0; pass < kPasses; pass++)
+      {
+        for (NRS* row : rows)
+        {
+          sum += read(*row);
+        }
+      }
+    });
+
+    std::chrono::duration<double> dt = Clock::now() - t0;
+
+    Sink += sum;
+
+    const double values = (double)kRows * kPasses * 3;
+
+    printf("%-32s %10.2f ms %8.1f ns/value %10zu allocs\n",
+           name, dt.count() * 1e3, dt.count() * 1e9 / values, usage.Allocations);
+  };
+
+  Run("stoll", [](NRS& row)
+  {
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      sum += std::stoll(std::string(row.GetString(i)));
+    }
+
+    return sum;
+  });
+
+  Run("TryGetInt", [](NRS& row)
+  {
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      sum += row.TryGetInt(i).value_or(0);
+    }
+
+    return sum;
+  });
+
+  Run("TryGetRGB", [](NRS& row)
+  {
+    NRS::RGB c = row.TryGetRGB().value_or(NRS::RGB());
+    return (uint64_t)c.R + c.G + c.B;
+  });
+
+  doc.CacheNumbers(true);
+
+  Run("TryGetInt, cached", [](NRS& row)
+  {
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      sum += row.TryGetInt(i).value_or(0);
+    }
+
+    return sum;
+  });
+}
+
+// =============================================================================
+
+//
+// Baseline NRS::GetNode(), substr for every segment on top of operator[].
+//
+LegacyNrsNode& LegacyNrsGetNode(LegacyNrsNode& n, const std::string& path)
+{
+  size_t pos = path.find_first_of('.');
+  if (pos != std::string::npos)
+  {
+    std::string nodeName = path.substr(0, pos);
+    return LegacyNrsGetNode(n[nodeName], path.substr(pos + 1, path.length()));
+  }
+  else
+  {
+    return n[path];
+  }
+}
+
+// =============================================================================
+
+void BenchNrsPathLookup()
+{
+  const size_t kSections = 64;
+  const size_t kKeys     = 32;
+  const size_t kPaths    = 256;
+  const size_t kPasses   = 2000;
+
+  printf("--- NRS path lookup (%zu paths of 3 segments, %zu passes) ---\n",
+         kPaths, kPasses);
+
+  NRS doc;
+  LegacyNrsNode legacy;
+
+  for (size_t i = 0; i < kSections; i++)
+  {
+    for (size_t j = 0; j < kKeys; j++)
+    {
+      std::string path = "scene.section" + std::to_string(i)
+                       + ".parameter" + std::to_string(j);
+
+      doc.GetNode(path).SetUInt(i * kKeys + j);
+      LegacyNrsGetNode(legacy, path).SetString(std::to_string(i * kKeys + j), 0);
+    }
+  }
+
+  std::vector<std::string> paths;
+
+  for (size_t i = 0; i < kPaths; i++)
+  {
+    paths.push_back("scene.section" + std::to_string((i * 37) % kSections)
+                  + ".parameter" + std::to_string((i * 11) % kKeys));
+  }
+
+  std::vector<NRS::Path> handles;
+
+  for (const std::string& path : paths)
+  {
+    handles.emplace_back(path);
+  }
+
+  auto Run = [&](const char* name, const std::function<uint64_t(size_t)>& lookup)
+  {
+    uint64_t sum = 0;
+
+    Clock::time_point t0 = Clock::now();
+
+    HeapUsage usage = MeasureHeap([&]()
+    {
+      for (size_t pass = 0; pass < kPasses; pass++)
+      {
+        for (size_t i = 0; i < kPaths; i++)
+        {
+          sum += lookup(i);
+        }
+      }
+    });
+
+    std::chrono::duration<double> dt = Clock::now() - t0;
+
+    Sink += sum;
+
+    const double lookups = (double)kPaths * kPasses;
+
+    printf("%-32s %10.2f ms %8.1f ns/lookup %10zu allocs\n",
+           name, dt.count() * 1e3, dt.count() * 1e9 / lookups, usage.Allocations);
+  };
+
+  Run("legacy GetNode", [&](size_t i)
+  {
+    return (uint64_t)LegacyNrsGetNode(legacy, paths[i]).Content.size();
+  });
+
+  Run("GetNode", [&](size_t i)
+  {
+    return (uint64_t)doc.GetNode(paths[i]).ValuesCount();
+  });
+
+  Run("Find", [&](size_t i)
+  {
+    return (uint64_t)doc.Find(paths[i])->ValuesCount();
+  });
+
+  Run("Find, precompiled path", [&](size_t i)
+  {
+    return (uint64_t)doc.Find(handles[i])->ValuesCount();
+  });
+}
+
+// =============================================================================
+
+//
+// Golden image check: every bundled background is rendered with the original
+// per-pixel loop and with BuildOffsetTables() + Gather() over a sequence of
+// frames for several parameter sets, and every frame must match byte for
+// byte. Returns false on any difference.
+//
+bool CheckStagedRenderer(size_t frames)
+{
+  struct Params
+  {
+    const char* Name;
+
+    int ScrollSpeedH;
+    int ScrollSpeedV;
+
+    double ScanlineFactorX;
+    double ScanlineFactorY;
+
+    double AngleIncreaseX;
+    double AngleIncreaseY;
+  };
+
+  const std::vector<Params> paramSets =
+  {
+    { "static",       0,  0,  0.0,  0.0,  0.0,  0.0  },
+    { "scroll",       3, -2,  0.0,  0.0,  0.0,  0.0  },
+    { "wave",         0,  0,  8.5,  3.25, 0.05, 0.37 },
+    { "scroll+wave", -5,  4, 31.0, 17.0,  0.9,  0.11 },
+    //
+    // Offsets of several image sizes in both directions.
+    //
+    { "large",        7, -3, 700.0, 450.0, 1.3, 0.7  },
+  };
+
+  frames = std::min(frames, (size_t)120);
+
+  printf("--- check: staged renderer vs per-pixel loop (%zu frames) ---\n",
+         frames);
+
+  auto backgrounds = LoadAllBackgrounds();
+  if (backgrounds.empty())
+  {
+    printf("No backgrounds!\n");
+    return false;
+  }
+
+  //
+  // Bundled backgrounds are all 256x256, so add one of non power of two
+  // size, where wrapping goes through tables and modulo instead of mask.
+  //
+  const uint32_t kOddWidth  = 200;
+  const uint32_t kOddHeight = 120;
+
+  std::vector<uint32_t> oddPixels((size_t)kOddWidth * kOddHeight);
+
+  for (size_t i = 0; i < oddPixels.size(); i++)
+  {
+    oddPixels[i] = 0xFF000000u | (uint32_t)(i * 2654435761u >> 8);
+  }
+
+  backgrounds.push_back(std::make_unique<BgImage>());
+  backgrounds.back()->SetPixels(kOddWidth, kOddHeight, std::move(oddPixels));
+  backgrounds.back()->Fname = "synthetic.bmp";
+
+  std::unique_ptr<OffsetTables> tables = std::make_unique<OffsetTables>();
+
+  std::vector<uint32_t> reference;
+  std::vector<uint32_t> out;
+
+  bool allMatch = true;
+
+  for (auto& bg : backgrounds)
+  {
+    const size_t framePixels = (size_t)bg->Width * bg->Height;
+
+    reference.assign(framePixels, 0);
+    out.assign(framePixels, 0);
+
+    std::string name = std::filesystem::path(bg->Fname).stem().string();
+
+    for (const Params& p : paramSets)
+    {
+      bg->ResetParams();
+
+      //
+      // Per scanline distortion engine has no per-pixel original.
+      //
+      bg->CurrentDistortion = Distortion();
+
+      bg->PhaseX = 0;
+      bg->PhaseY = 0;
+      bg->ScrollSpeedH    = p.ScrollSpeedH;
+      bg->ScrollSpeedV    = p.ScrollSpeedV;
+      bg->ScanlineFactorX = p.ScanlineFactorX;
+      bg->ScanlineFactorY = p.ScanlineFactorY;
+
+      const uint32_t phaseIncX = DegreesToPhase(p.AngleIncreaseX);
+      const uint32_t phaseIncY = DegreesToPhase(p.AngleIncreaseY);
+
+      uint32_t phaseX  = bg->PhaseX;
+      uint32_t phaseY  = bg->PhaseY;
+      int      offsetY = bg->ScanlineOffsetY;
+
+      size_t mismatch = frames;
+
+      for (size_t i = 0; i < frames and mismatch == frames; i++)
+      {
+        RenderPerPixel(*bg, phaseIncX, phaseIncY, phaseX, phaseY, offsetY,
+                       reference.data());
+
+        BuildOffsetTables(*bg, phaseIncX, phaseIncY, *tables);
+        Gather(*bg, *tables, out.data());
+
+        if (out != reference)
+        {
+          mismatch = i;
+        }
+
+        AdvanceBackground(*bg, phaseIncX, phaseIncY, bg->Width, bg->Height, kFrameTime);
+      }
+
+      if (mismatch != frames)
+      {
+        printf("%-24s %-12s MISMATCH at frame %zu!\n",
+               name.data(), p.Name, mismatch);
+        allMatch = false;
+      }
+    }
+
+    printf("%-24s %ux%u, %zu parameter sets checked\n",
+           name.data(), bg->Width, bg->Height, paramSets.size());
+  }
+
+  printf("%s\n", allMatch ? "OK" : "FAILED");
+
+  return allMatch;
+}
+
+// =============================================================================
+
+//
+// Ticks of fixed length worth kSeconds must shift every cycle exactly
+// Rate * kSeconds times, whatever the rate and whatever the tick rate
+// ("--tick-rate" in the app, "--frame-rate" in headless mode), so that
+// animation speed doesn't depend on either.
+//
+bool CheckPaletteCycleRates()
+{
+  const size_t kSeconds = 10;
+
+  const std::vector<uint32_t> rates = { 1, 7, 15, 30, 60, 200 };
+
+  const std::vector<double> tickRates = { 30.0, 50.0, 60.0, 120.0, 144.0 };
+
+  printf("--- check: palette cycle rates (%zu s of ticks) ---\n", kSeconds);
+
+  std::unique_ptr<BgImage> bg = std::make_unique<BgImage>();
+
+  bg->PaletteColorByIndex.resize(kMaxPaletteSize);
+
+  bool allMatch = true;
+
+  for (double tickRate : tickRates)
+  {
+    for (uint32_t rate : rates)
+    {
+      PaletteCycle cycle;
+      cycle.Start = 0;
+      cycle.End   = kMaxPaletteSize - 1;
+      cycle.Rate  = rate;
+
+      bg->PaletteCycles = { cycle };
+
+      const uint32_t length = cycle.Length();
+      const size_t   ticks  = (size_t)std::llround(tickRate * kSeconds);
+
+      size_t shifts = 0;
+
+      for (size_t i = 0; i < ticks; i++)
+      {
+        uint32_t oldOffset = bg->PaletteCycles[0].Offset;
+
+        bg->AdvancePaletteCycles(1.0 / tickRate);
+
+        shifts += (bg->PaletteCycles[0].Offset + length - oldOffset) % length;
+      }
+
+      const size_t expected = (size_t)rate * kSeconds;
+
+      printf("%6.0f ticks/s, rate %3u: %6zu shifts, expected %6zu%s\n",
+             tickRate, rate, shifts, expected,
+             (shifts == expected) ? "" : " MISMATCH!");
+
+      allMatch = allMatch and (shifts == expected);
+    }
+  }
+
+  printf("%s\n", allMatch ? "OK" : "FAILED");
+
+  return allMatch;
+}
+
+// =============================================================================
+
+int main(int argc, char* argv[])
+{
+  size_t frames = 2000;
+
+  uint64_t seed = 1;
+
+  std::string csvFname;
+  std::string jsonFname;
+
+  //
+  // Empty means all sections.
+  //
+  std::string only;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+
+    if (arg == "--seed" and i + 1 < argc)
+    {
+      seed = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if (arg == "--csv" and i + 1 < argc)
+    {
+      csvFname = argv[++i];
+    }
+    else if (arg == "--json" and i + 1 < argc)
+    {
+      jsonFname = argv[++i];
+    }
+    else if (arg == "--only" and i + 1 < argc)
+    {
+      only = argv[++i];
+    }
+    else
+    {
+      frames = std::strtoul(argv[i], nullptr, 10);
+    }
+  }
+
+  auto Enabled = [&only](const char* section)
+  {
+    return (only.empty() or only == section);
+  };
+
+  if (Enabled("loading"))
+  {
+    BenchLoading();
+  }
+
+  if (Enabled("sine"))
+  {
+    BenchSineVsLut(frames);
+  }
+
+  if (Enabled("palette"))
+  {
+    BenchPaletteKernels(frames);
+  }
+
+  if (Enabled("parallel"))
+  {
+    BenchParallel(frames);
+  }
+
+  if (Enabled("compositor"))
+  {
+    BenchCompositor(frames);
+  }
+
+  if (Enabled("distortion"))
+  {
+    BenchDistortion(frames);
+  }
+
+  if (Enabled("nrs"))
+  {
+    BenchNrs();
+    BenchNrsFileLoading();
+    BenchNrsTypedGetters();
+    BenchNrsPathLookup();
+  }
+
+  bool checksPassed = true;
+
+  if (Enabled("check"))
+  {
+    checksPassed = CheckStagedRenderer(frames);
+    checksPassed = CheckPaletteCycleRates() and checksPassed;
+  }
+
+  if (Enabled("frames"))
+  {
+    std::vector<FrameStats> stats = BenchFrames(frames, seed);
+
+    if (not csvFname.empty())
+    {
+      WriteCSV(stats, csvFname);
+    }
+
+    if (not jsonFname.empty())
+    {
+      WriteJSON(stats, jsonFname, seed);
+    }
+  }
+
+  return checksPassed ? 0 : 1;
+}
@@ -0,0 +1,603 @@
+#include "bg-effect.h"
+#include "sine-lut.h"
+
+#include <algorithm>
+
+namespace
+{
+  inline int ScanlineOffset(uint32_t phase, int32_t factor, int size)
+  {
+    int offset = FixedMulToInt(SineFixed(phase), factor);
+    if (offset < 0)
+    {
+      offset += (size - 1);
+    }
+
+    return offset;
+  }
+
+  // ===========================================================================
+
+  //
+  // Into [0, size) for any sign, since size_t wrapping around zero is only
+  // the same as wrapping around size for power of two sizes.
+  //
+  inline size_t WrapSigned(int64_t coord, uint32_t size)
+  {
+    int64_t res = coord % (int64_t)size;
+    if (res < 0)
+    {
+      res += size;
+    }
+
+    return (size_t)res;
+  }
+
+  // ===========================================================================
+
+  //
+  // Offset bigger than the image can take coordinate below zero, and size_t
+  // wrapping around zero is not the same as wrapping around non power of
+  // two size, so those go through WrapSigned(). Everything else takes the
+  // fast path of wrap.
+  //
+  inline uint16_t WrapCoord(int64_t coord, const CoordWrap& wrap)
+  {
+    return (coord >= 0)
+           ? wrap((size_t)coord)
+           : (uint16_t)WrapSigned(coord, wrap.Size);
+  }
+
+  // ===========================================================================
+
+  //
+  // Speed can be negative.
+  //
+  size_t Scroll(size_t pos, int speed, uint32_t size)
+  {
+    return WrapSigned((int64_t)pos + speed, size);
+  }
+
+  // ===========================================================================
+
+  //
+  // Per scanline distortion (see distortion.h): one sine per row, and row
+  // itself is either shifted as a whole or taken from another source row,
+  // so columns of a row are always consecutive.
+  //
+  void BuildDistortedRows(const BgImage& bg,
+                          uint32_t yBegin,
+                          uint32_t yEnd,
+                          OffsetTables& tables)
+  {
+    const Distortion& d = bg.CurrentDistortion;
+
+    const int32_t  amplitude   = ToFixed(d.Amplitude);
+    const uint32_t rowInc      = DegreesToPhase(d.Frequency);
+    const int64_t  compression = ToFixed(1.0 + d.Compression);
+
+    const uint32_t width = tables.Width;
+
+    uint32_t phase = d.Phase + rowInc * yBegin;
+
+    for (uint32_t y = yBegin; y < yEnd; y++)
+    {
+      int offset = FixedMulToInt(SineFixed(phase), amplitude);
+
+      int64_t sourceY = y;
+      int64_t shiftX  = 0;
+
+      switch (d.Type)
+      {
+        case DistortionType::HORIZONTAL:
+          shiftX = offset;
+          break;
+
+        case DistortionType::HORIZONTAL_INTERLACED:
+          shiftX = (y % 2 == 0) ? offset : -offset;
+          break;
+
+        case DistortionType::VERTICAL:
+          sourceY = ((int64_t)y * compression) / kFixedOne + offset;
+          break;
+
+        default:
+          break;
+      }
+
+      tables.SourceRow[y] = WrapSigned(sourceY + bg.ScrollPosY, bg.Height);
+
+      size_t startX = WrapSigned(shiftX + bg.ScrollPosX, bg.Width);
+
+      uint16_t* columns = tables.Columns(y);
+
+      for (uint32_t x = 0; x < width; x++)
+      {
+        columns[x] = bg.WrapX(startX + x);
+      }
+
+      phase += rowInc;
+    }
+  }
+
+  // ===========================================================================
+
+  //
+  // Phase of every pixel is just start phase + pixel index * increment, so
+  // each row can start from its own phase directly and the whole thing is
+  // integer only. Vertical offset of row Y is taken at the phase it had
+  // after Y rows worth of pixels, as it was with per-pixel angle
+  // accumulation.
+  //
+  // Rows don't depend on each other, so any range of them can be built
+  // separately and bg itself is not modified.
+  //
+  // Output size is the size of tables, which doesn't have to match bg
+  // (layers of different size can be composited together).
+  //
+  void BuildRows(const BgImage& bg,
+                 uint32_t phaseIncX,
+                 uint32_t phaseIncY,
+                 uint32_t yBegin,
+                 uint32_t yEnd,
+                 OffsetTables& tables)
+  {
+    if (bg.CurrentDistortion.Type != DistortionType::NONE)
+    {
+      BuildDistortedRows(bg, yBegin, yEnd, tables);
+      return;
+    }
+
+    const int32_t factorX = ToFixed(bg.ScanlineFactorX);
+    const int32_t factorY = ToFixed(bg.ScanlineFactorY);
+
+    const uint32_t width = tables.Width;
+
+    const uint32_t rowIncX = phaseIncX * width;
+    const uint32_t rowIncY = phaseIncY * width;
+
+    uint32_t rowPhaseX = bg.PhaseX + rowIncX * yBegin;
+    uint32_t rowPhaseY = bg.PhaseY + rowIncY * yBegin;
+
+    for (uint32_t y = yBegin; y < yEnd; y++)
+    {
+      int offsetY = ScanlineOffset(rowPhaseY, factorY, bg.Height);
+
+      int64_t iy = (int64_t)y + bg.ScrollPosY + offsetY;
+
+      tables.SourceRow[y] = WrapCoord(iy, bg.WrapY);
+
+      uint32_t phase = rowPhaseX;
+
+      uint16_t* columns = tables.Columns(y);
+
+      for (uint32_t x = 0; x < width; x++)
+      {
+        int offsetX = ScanlineOffset(phase, factorX, bg.Width);
+
+        int64_t ix = (int64_t)x + bg.ScrollPosX + offsetX;
+
+        columns[x] = WrapCoord(ix, bg.WrapX);
+
+        phase += phaseIncX;
+      }
+
+      rowPhaseX += rowIncX;
+      rowPhaseY += rowIncY;
+    }
+  }
+
+  // ===========================================================================
+
+  //
+  // Advances bg by one frame worth of pixels, as if all rows of width x
+  // height tables were built.
+  //
+  void AdvanceAngles(BgImage& bg,
+                     uint32_t phaseIncX,
+                     uint32_t phaseIncY,
+                     uint32_t width,
+                     uint32_t height)
+  {
+    const int32_t factorX = ToFixed(bg.ScanlineFactorX);
+    const int32_t factorY = ToFixed(bg.ScanlineFactorY);
+
+    //
+    // Phase wraps around 2^32 anyway, so overflow here is fine.
+    //
+    const uint32_t framePixels = width * height;
+
+    const uint32_t frameIncX = phaseIncX * framePixels;
+    const uint32_t frameIncY = phaseIncY * framePixels;
+
+    //
+    // Horizontal offset of the very last pixel of the frame.
+    //
+    uint32_t lastPhaseX = bg.PhaseX + frameIncX - phaseIncX;
+
+    bg.ScanlineOffsetX = ScanlineOffset(lastPhaseX, factorX, bg.Width);
+
+    bg.PhaseX += frameIncX;
+    bg.PhaseY += frameIncY;
+
+    bg.ScanlineOffsetY = ScanlineOffset(bg.PhaseY, factorY, bg.Height);
+  }
+
+  // ===========================================================================
+
+  //
+  // Per channel operations on 4 channels packed in uint32_t at once.
+  // Alpha is 255 in both, so it stays 255.
+  //
+  inline uint32_t Average2(uint32_t a, uint32_t b)
+  {
+    return (a & b) + (((a ^ b) & 0xFEFEFEFEu) >> 1);
+  }
+
+  inline uint32_t AddSaturate(uint32_t a, uint32_t b)
+  {
+    //
+    // Sum of low 7 bits can't carry into next channel, top bit is added
+    // separately with xor. Channel overflowed if (a + b) / 2 >= 128.
+    //
+    uint32_t sum      = ((a & 0x7F7F7F7Fu) + (b & 0x7F7F7F7Fu)) ^ ((a ^ b) & 0x80808080u);
+    uint32_t overflow = Average2(a, b) & 0x80808080u;
+
+    return sum | ((overflow >> 7) * 0xFFu);
+  }
+
+
+  // ===========================================================================
+
+  PaletteKernel BestKernel()
+  {
+    static const PaletteKernel kBestKernel = GetPaletteKernel(SelectPaletteKernel());
+
+    return kBestKernel;
+  }
+
+  // ===========================================================================
+
+  //
+  // dst points to the output row yBegin.
+  //
+  void GatherRows(const BgImage& bg,
+                  const OffsetTables& tables,
+                  uint32_t yBegin,
+                  uint32_t yEnd,
+                  uint32_t* dst,
+                  PaletteKernel kernel)
+  {
+    const uint32_t width = tables.Width;
+
+    for (uint32_t y = yBegin; y < yEnd; y++)
+    {
+      const size_t    rowStart = (size_t)tables.SourceRow[y] * bg.Width;
+      const uint16_t* columns  = tables.Columns(y);
+
+      if (bg.IsIndexed())
+      {
+        kernel(bg.Indices.data() + rowStart,
+               nullptr,
+               columns,
+               bg.ColorLut,
+               dst,
+               width);
+      }
+      else if (not bg.PaletteIndices.empty())
+      {
+        kernel(bg.PaletteIndices.data() + rowStart,
+               bg.TrueColor.data() + rowStart,
+               columns,
+               bg.PaletteLut,
+               dst,
+               width);
+      }
+      else
+      {
+        const uint32_t* row = bg.TrueColor.data() + rowStart;
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+          dst[x] = row[columns[x]];
+        }
+      }
+
+      dst += width;
+    }
+  }
+}
+
+// =============================================================================
+
+void OffsetTables::Resize(uint32_t width, uint32_t height)
+{
+  if (width == Width and height == Height)
+  {
+    return;
+  }
+
+  Width  = width;
+  Height = height;
+
+  SourceRow.assign(height, 0);
+  SourceColumn.assign((size_t)width * height, 0);
+}
+
+// =============================================================================
+
+void BuildOffsetTables(const BgImage& bg,
+                       uint32_t phaseIncX,
+                       uint32_t phaseIncY,
+                       OffsetTables& tables)
+{
+  tables.Resize(bg.Width, bg.Height);
+
+  BuildRows(bg, phaseIncX, phaseIncY, 0, bg.Height, tables);
+}
+
+// =============================================================================
+
+void Gather(const BgImage& bg,
+            const OffsetTables& tables,
+            uint32_t* dst,
+            PaletteKernel kernel)
+{
+  if (kernel == nullptr)
+  {
+    kernel = BestKernel();
+  }
+
+  GatherRows(bg, tables, 0, bg.Height, dst, kernel);
+}
+
+// =============================================================================
+
+void RenderParallel(const BgImage& bg,
+                    uint32_t phaseIncX,
+                    uint32_t phaseIncY,
+                    OffsetTables& tables,
+                    uint32_t* dst,
+                    ThreadPool& pool,
+                    PaletteKernel kernel)
+{
+  if (kernel == nullptr)
+  {
+    kernel = BestKernel();
+  }
+
+  tables.Resize(bg.Width, bg.Height);
+
+  const size_t height = bg.Height;
+
+  //
+  // A few bands per thread, so that one slow thread doesn't hold up
+  // the whole frame.
+  //
+  const size_t bandsCount = std::min(pool.ThreadsCount() * kBandsPerThread,
+                                     height);
+
+  const size_t bandHeight = (height + bandsCount - 1) / bandsCount;
+
+  pool.ParallelFor(bandsCount, [&](size_t band)
+  {
+    uint32_t yBegin = std::min(band * bandHeight, height);
+    uint32_t yEnd   = std::min(yBegin + bandHeight, height);
+
+    BuildRows(bg, phaseIncX, phaseIncY, yBegin, yEnd, tables);
+    GatherRows(bg, tables, yBegin, yEnd, dst + (size_t)yBegin * bg.Width, kernel);
+  });
+}
+
+// =============================================================================
+
+const char* BlendModeName(BlendMode mode)
+{
+  static const char* kNames[] =
+  {
+    "interlace",
+    "average",
+    "additive"
+  };
+
+  return ((size_t)mode < (size_t)BlendMode::LAST_ELEMENT)
+         ? kNames[(size_t)mode]
+         : "???";
+}
+
+// =============================================================================
+
+void CompositeLayers(std::vector<BgLayer>& layers,
+                     BlendMode mode,
+                     uint32_t width,
+                     uint32_t height,
+                     uint32_t* dst,
+                     ThreadPool& pool)
+{
+  if (layers.empty())
+  {
+    return;
+  }
+
+  const PaletteKernel kernel = BestKernel();
+
+  const size_t layersCount = layers.size();
+
+  for (BgLayer& layer : layers)
+  {
+    layer.Tables.Resize(width, height);
+  }
+
+  auto GatherRow = [&](size_t index, uint32_t y, uint32_t* out)
+  {
+    BgLayer& layer = layers[index];
+
+    GatherRows(*layer.Image, layer.Tables, y, y + 1, out, kernel);
+  };
+
+  const size_t bandsCount = std::min(pool.ThreadsCount() * kBandsPerThread,
+                                     (size_t)height);
+
+  const size_t bandHeight = (height + bandsCount - 1) / bandsCount;
+
+  pool.ParallelFor(bandsCount, [&](size_t band)
+  {
+    uint32_t yBegin = std::min(band * bandHeight, (size_t)height);
+    uint32_t yEnd   = std::min(yBegin + bandHeight, (size_t)height);
+
+    thread_local std::vector<uint32_t> layerRow;
+    thread_local std::vector<uint16_t> sums;
+
+    layerRow.resize(width);
+
+    //
+    // Offsets for the whole band first, since building them row by row
+    // interleaved with gathering turned out to be noticeably slower.
+    // With interlace only every layersCount-th row of a layer is needed.
+    //
+    if (mode == BlendMode::INTERLACE)
+    {
+      for (uint32_t y = yBegin; y < yEnd; y++)
+      {
+        BgLayer& layer = layers[y % layersCount];
+
+        BuildRows(*layer.Image,
+                  layer.PhaseIncX,
+                  layer.PhaseIncY,
+                  y,
+                  y + 1,
+                  layer.Tables);
+      }
+    }
+    else
+    {
+      for (BgLayer& layer : layers)
+      {
+        BuildRows(*layer.Image,
+                  layer.PhaseIncX,
+                  layer.PhaseIncY,
+                  yBegin,
+                  yEnd,
+                  layer.Tables);
+      }
+    }
+
+    //
+    // Whole row of all layers is gathered and blended while it's still in
+    // cache, so output is written only once.
+    //
+    for (uint32_t y = yBegin; y < yEnd; y++)
+    {
+      uint32_t* out = dst + (size_t)y * width;
+
+      if (mode == BlendMode::INTERLACE or layersCount == 1)
+      {
+        GatherRow(y % layersCount, y, out);
+        continue;
+      }
+
+      if (mode == BlendMode::AVERAGE and layersCount > 2)
+      {
+        sums.assign((size_t)width * 4, 0);
+
+        for (size_t i = 0; i < layersCount; i++)
+        {
+          GatherRow(i, y, layerRow.data());
+
+          const uint8_t* channels = (const uint8_t*)layerRow.data();
+
+          for (size_t c = 0; c < sums.size(); c++)
+          {
+            sums[c] += channels[c];
+          }
+        }
+
+        uint8_t* channels = (uint8_t*)out;
+
+        for (size_t c = 0; c < sums.size(); c++)
+        {
+          channels[c] = sums[c] / layersCount;
+        }
+
+        continue;
+      }
+
+      GatherRow(0, y, out);
+
+      for (size_t i = 1; i < layersCount; i++)
+      {
+        GatherRow(i, y, layerRow.data());
+
+        const uint32_t* src = layerRow.data();
+
+        if (mode == BlendMode::AVERAGE)
+        {
+          for (uint32_t x = 0; x < width; x++)
+          {
+            out[x] = Average2(out[x], src[x]);
+          }
+        }
+        else
+        {
+          for (uint32_t x = 0; x < width; x++)
+          {
+            out[x] = AddSaturate(out[x], src[x]);
+          }
+        }
+      }
+    }
+  });
+}
+
+// =============================================================================
+
+void AdvanceBackground(BgImage& bg,
+                       uint32_t phaseIncX,
+                       uint32_t phaseIncY,
+                       uint32_t width,
+                       uint32_t height,
+                       double dt)
+{
+  AdvanceAngles(bg, phaseIncX, phaseIncY, width, height);
+
+  if (bg.CurrentDistortion.Type != DistortionType::NONE)
+  {
+    bg.CurrentDistortion.Advance();
+  }
+
+  bg.ScrollPosX = Scroll(bg.ScrollPosX, bg.ScrollSpeedH, bg.Width);
+  bg.ScrollPosY = Scroll(bg.ScrollPosY, bg.ScrollSpeedV, bg.Height);
+
+  bg.AdvancePaletteCycles(dt);
+}
+
+// =============================================================================
+
+bool IsAnimated(const BgImage& bg, uint32_t phaseIncX, uint32_t phaseIncY)
+{
+  if (bg.ScrollSpeedH != 0 or bg.ScrollSpeedV != 0)
+  {
+    return true;
+  }
+
+  for (const PaletteCycle& cycle : bg.PaletteCycles)
+  {
+    if (cycle.Rate != 0 and cycle.Length() > 1)
+    {
+      return true;
+    }
+  }
+
+  const Distortion& d = bg.CurrentDistortion;
+
+  if (d.Type != DistortionType::NONE)
+  {
+    return (d.Speed != 0.0
+         or d.AmplitudeAcceleration != 0.0
+         or d.FrequencyAcceleration != 0.0
+         or d.CompressionAcceleration != 0.0);
+  }
+
+  return ((phaseIncX != 0 and ToFixed(bg.ScanlineFactorX) != 0)
+       or (phaseIncY != 0 and ToFixed(bg.ScanlineFactorY) != 0));
+}
@@ -0,0 +1,151 @@
+#ifndef BG_EFFECT_H
+#define BG_EFFECT_H
+
+#include "bg-image.h"
+#include "palette-kernel.h"
+#include "thread-pool.h"
+
+//
+// Source coordinates for every output pixel, rebuilt once per frame by
+// BuildOffsetTables(). Vertical offset changes only once per scanline, so it
+// is stored per row, while horizontal one depends on angle that advances per
+// pixel, so it has to be stored per row and column.
+//
+struct OffsetTables
+{
+  uint32_t Width  = 0;
+  uint32_t Height = 0;
+
+  std::vector<uint16_t> SourceRow;
+
+  //
+  // Height rows of Width columns.
+  //
+  std::vector<uint16_t> SourceColumn;
+
+  // ---------------------------------------------------------------------------
+
+  //
+  // Does nothing if size is the same.
+  //
+  void Resize(uint32_t width, uint32_t height);
+
+  uint16_t* Columns(uint32_t y)
+  {
+    return SourceColumn.data() + (size_t)y * Width;
+  }
+
+  const uint16_t* Columns(uint32_t y) const
+  {
+    return SourceColumn.data() + (size_t)y * Width;
+  }
+};
+
+// =============================================================================
+
+//
+// Both phase increments are per pixel. Frame is built from bg state as it
+// is, animation is moved forward by AdvanceBackground() only.
+//
+void BuildOffsetTables(const BgImage& bg,
+                       uint32_t phaseIncX,
+                       uint32_t phaseIncY,
+                       OffsetTables& tables);
+
+//
+// Pure integer gather into RGBA32 buffer of bg.Width x bg.Height.
+// If kernel is not specified, the best one for current CPU is used.
+//
+void Gather(const BgImage& bg,
+            const OffsetTables& tables,
+            uint32_t* dst,
+            PaletteKernel kernel = nullptr);
+
+//
+// Same result as BuildOffsetTables() followed by Gather(), but rows are split
+// into bands, and every band is built and gathered on its own thread of the
+// pool. Every row depends only on its own index and bg state at the start of
+// the frame, so output is the same regardless of threads count.
+//
+const size_t kBandsPerThread = 4;
+
+void RenderParallel(const BgImage& bg,
+                    uint32_t phaseIncX,
+                    uint32_t phaseIncY,
+                    OffsetTables& tables,
+                    uint32_t* dst,
+                    ThreadPool& pool,
+                    PaletteKernel kernel = nullptr);
+
+enum class BlendMode
+{
+  //
+  // Row Y is taken from layer (Y % layers count), other layers are not
+  // rendered for that row at all.
+  //
+  INTERLACE = 0,
+  //
+  // Per channel mean of all layers.
+  //
+  AVERAGE,
+  //
+  // Per channel sum of all layers, saturated at 255.
+  //
+  ADDITIVE,
+  LAST_ELEMENT
+};
+
+const char* BlendModeName(BlendMode mode);
+
+//
+// Every layer has its own scroll / distortion / palette state in Image.
+//
+struct BgLayer
+{
+  const BgImage* Image = nullptr;
+
+  uint32_t PhaseIncX = 0;
+  uint32_t PhaseIncY = 0;
+
+  OffsetTables Tables;
+};
+
+//
+// Renders all layers into width x height RGBA32 dst and blends them in one
+// pass: every output row is built, gathered and blended for all layers
+// before moving on to the next one, instead of rendering every layer into
+// its own buffer and blending afterwards. Layers are sampled with wrap
+// around, so they don't have to be of output size.
+// Output doesn't depend on pool size.
+//
+void CompositeLayers(std::vector<BgLayer>& layers,
+                     BlendMode mode,
+                     uint32_t width,
+                     uint32_t height,
+                     uint32_t* dst,
+                     ThreadPool& pool);
+
+//
+// One step of animation: distortion angles by one frame worth of pixels
+// (both phase increments are per pixel, as in BuildOffsetTables()),
+// distortion parameters, scroll, and palette cycling (every cycle keeps
+// its own timer in bg). dt is length of the step in seconds.
+//
+// width x height is the size bg was rendered at, i.e. size of its offset
+// tables, which is not bg size when it's a layer of a composite of
+// different size. Next frame then starts where this one ended.
+//
+void AdvanceBackground(BgImage& bg,
+                       uint32_t phaseIncX,
+                       uint32_t phaseIncY,
+                       uint32_t width,
+                       uint32_t height,
+                       double dt);
+
+//
+// False if AdvanceBackground() with the same phase increments can't change
+// what the background looks like, so there is no need to render it again.
+//
+bool IsAnimated(const BgImage& bg, uint32_t phaseIncX, uint32_t phaseIncY);
+
+#endif // BG_EFFECT_H
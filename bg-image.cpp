@@ -0,0 +1,868 @@
+#include "bg-image.h"
+#include "util.h"
+#include "nrs.h"
+
+#include <filesystem>
+#include <set>
+#include <sstream>
+
+void CoordWrap::Init(uint32_t size)
+{
+  Size = size;
+  Mask = 0;
+
+  Table.clear();
+
+  if ((size & (size - 1)) == 0)
+  {
+    Mask = size - 1;
+    return;
+  }
+
+  Table.resize(size * kWrapTableSpan);
+
+  for (size_t i = 0; i < Table.size(); i++)
+  {
+    Table[i] = i % size;
+  }
+}
+
+// =============================================================================
+
+void PaletteCycle::Step()
+{
+  const uint32_t length = Length();
+
+  if (length < 2)
+  {
+    return;
+  }
+
+  switch (Mode)
+  {
+    case CycleMode::FORWARD:
+      Offset = (Offset + 1) % length;
+      break;
+
+    case CycleMode::REVERSE:
+      Offset = (Offset + length - 1) % length;
+      break;
+
+    case CycleMode::PING_PONG:
+    {
+      Offset = MovingBack ? (Offset - 1) : (Offset + 1);
+
+      if (Offset == length - 1)
+      {
+        MovingBack = true;
+      }
+      else if (Offset == 0)
+      {
+        MovingBack = false;
+      }
+    }
+    break;
+
+    default:
+      break;
+  }
+}
+
+// =============================================================================
+
+void PaletteCycle::Reset()
+{
+  Offset     = 0;
+  MovingBack = false;
+  TimeAcc    = 0.0;
+}
+
+// =============================================================================
+
+const char* CycleModeName(CycleMode mode)
+{
+  static const char* kNames[] =
+  {
+    "forward",
+    "reverse",
+    "pingPong"
+  };
+
+  return ((size_t)mode < (size_t)CycleMode::LAST_ELEMENT)
+         ? kNames[(size_t)mode]
+         : "???";
+}
+
+// =============================================================================
+
+uint32_t BgImage::GetPixel(uint32_t x, uint32_t y) const
+{
+  size_t i = (size_t)y * Width + x;
+
+  return IsIndexed() ? Colors[Indices[i]] : TrueColor[i];
+}
+
+// =============================================================================
+
+uint8_t BgImage::GetPaletteIndex(uint32_t x, uint32_t y) const
+{
+  size_t i = (size_t)y * Width + x;
+
+  if (IsIndexed())
+  {
+    return PaletteEntryByColor[Indices[i]];
+  }
+
+  return PaletteIndices.empty() ? kNotInPalette : PaletteIndices[i];
+}
+
+// =============================================================================
+
+void BgImage::SetPixels(uint32_t width,
+                        uint32_t height,
+                        std::vector<uint32_t>&& pixels)
+{
+  Width  = width;
+  Height = height;
+
+  WrapX.Init(width);
+  WrapY.Init(height);
+
+  Indices.clear();
+  Colors.clear();
+  PaletteEntryByColor.clear();
+  TrueColor.clear();
+  PaletteIndices.clear();
+
+  std::vector<uint8_t> indices(pixels.size() + kIndexPlanePadding, 0);
+
+  ColorIndexMap indexByColor;
+  indexByColor.reserve(kMaxIndexedColors + 1);
+
+  for (size_t i = 0; i < pixels.size(); i++)
+  {
+    auto it = indexByColor.find(pixels[i]);
+    if (it == indexByColor.end())
+    {
+      if (Colors.size() == kMaxIndexedColors)
+      {
+        Colors.clear();
+        TrueColor = std::move(pixels);
+        RebuildPaletteLut();
+        return;
+      }
+
+      it = indexByColor.emplace(pixels[i], Colors.size()).first;
+      Colors.push_back(pixels[i]);
+    }
+
+    indices[i] = it->second;
+  }
+
+  Indices = std::move(indices);
+
+  PaletteEntryByColor.assign(Colors.size(), kNotInPalette);
+
+  RebuildPaletteLut();
+}
+
+// =============================================================================
+
+size_t BgImage::MemoryUsed() const
+{
+  return sizeof(BgImage)
+       + Indices.capacity()
+       + Colors.capacity() * sizeof(uint32_t)
+       + PaletteEntryByColor.capacity()
+       + TrueColor.capacity() * sizeof(uint32_t)
+       + PaletteIndices.capacity()
+       + PaletteColorByIndex.capacity() * sizeof(SDL_Color)
+       + (WrapX.Table.capacity() + WrapY.Table.capacity()) * sizeof(uint16_t);
+}
+
+// =============================================================================
+
+void BgImage::ResetParams()
+{
+  ScrollSpeedH = 0;
+  ScrollSpeedV = 0;
+
+  ScrollPosX = 0;
+  ScrollPosY = 0;
+
+  ScanlineOffsetX = 0;
+  ScanlineOffsetY = 0;
+
+  ScanlineFactorX = 0.0;
+  ScanlineFactorY = 0.0;
+
+  for (PaletteCycle& cycle : PaletteCycles)
+  {
+    cycle.Reset();
+  }
+
+  CurrentDistortion = LoadedDistortion;
+
+  RebuildPaletteLut();
+}
+
+// =============================================================================
+
+void BgImage::RandomizeParams()
+{
+  ScrollSpeedH = ::RandomRange(-5, 5);
+  ScrollSpeedV = ::RandomRange(-5, 5);
+
+  ScrollPosX = 0;
+  ScrollPosY = 0;
+
+  ScanlineOffsetX = 0;
+  ScanlineOffsetY = 0;
+
+  ScanlineFactorX = ::Random01() * 10.0;
+  ScanlineFactorY = ::Random01() * 10.0;
+
+  for (PaletteCycle& cycle : PaletteCycles)
+  {
+    cycle.Reset();
+  }
+
+  CurrentDistortion = LoadedDistortion;
+
+  RebuildPaletteLut();
+}
+
+// =============================================================================
+
+std::string BgImage::GetColorDataString()
+{
+  //
+  // Colors table is already unique, true color plane has to be deduplicated.
+  //
+  const std::vector<uint32_t>& pixels = IsIndexed() ? Colors : TrueColor;
+
+  ColorIndexMap uniqueColors;
+
+  for (uint32_t pixel : pixels)
+  {
+    uniqueColors.emplace(pixel, uniqueColors.size());
+  }
+
+  std::set<std::string> allColors;
+
+  for (auto& item : uniqueColors)
+  {
+    SDL_Color c = UnpackRGBA32(item.first);
+
+    std::string key = std::to_string(c.r) +
+                      "/" +
+                      std::to_string(c.g) +
+                      "/" +
+                      std::to_string(c.b);
+    allColors.insert(key);
+  }
+
+  std::stringstream ss;
+
+  ss << "\n";
+
+  size_t ind = 1;
+
+  for (auto& entry : allColors)
+  {
+    ss << ind << " : " << entry << "\n";
+    ind++;
+  }
+
+  return ss.str();
+}
+
+// =============================================================================
+
+std::string BgImage::ToString()
+{
+  std::stringstream ss;
+
+  ss << "------ [PIXELS] ------\n";
+
+  for (uint32_t y = 0; y < Height; y++)
+  {
+    for (uint32_t x = 0; x < Width; x++)
+    {
+      SDL_Color c = UnpackRGBA32(GetPixel(x, y));
+
+      ss << "["
+         << (uint16_t)c.r
+         << ";"
+         << (uint16_t)c.g
+         << ";"
+         << (uint16_t)c.b
+         << "]";
+    }
+
+    ss << "\n";
+  }
+
+  ss << "------ [PALETTE] ------\n";
+
+  for (uint32_t y = 0; y < Height; y++)
+  {
+    for (uint32_t x = 0; x < Width; x++)
+    {
+      ss << "[" << (uint16_t)GetPaletteIndex(x, y) << "]";
+    }
+
+    ss << "\n";
+  }
+
+  return ss.str();
+}
+
+// =============================================================================
+
+void BgImage::ConstructPaletteMap()
+{
+  ColorIndexMap paletteIndexByColor;
+  paletteIndexByColor.reserve(PaletteColorByIndex.size());
+
+  //
+  // emplace() doesn't overwrite, so if palette has duplicates first one
+  // wins, same as it was with linear search.
+  //
+  for (size_t i = 0; i < PaletteColorByIndex.size(); i++)
+  {
+    paletteIndexByColor.emplace(PackRGBA32(PaletteColorByIndex[i]), i);
+  }
+
+  auto FindInPalette = [&paletteIndexByColor](uint32_t color)
+  {
+    auto it = paletteIndexByColor.find(color);
+
+    return (it == paletteIndexByColor.end()) ? kNotInPalette
+                                             : (uint8_t)it->second;
+  };
+
+  if (IsIndexed())
+  {
+    for (size_t i = 0; i < Colors.size(); i++)
+    {
+      PaletteEntryByColor[i] = FindInPalette(Colors[i]);
+    }
+  }
+  else
+  {
+    PaletteIndices.assign(TrueColor.size() + kIndexPlanePadding, kNotInPalette);
+
+    for (size_t i = 0; i < TrueColor.size(); i++)
+    {
+      PaletteIndices[i] = FindInPalette(TrueColor[i]);
+    }
+  }
+
+  RebuildPaletteLut();
+}
+
+// =============================================================================
+
+void BgImage::CyclePalette()
+{
+  if (PaletteCycles.empty())
+  {
+    return;
+  }
+
+  for (PaletteCycle& cycle : PaletteCycles)
+  {
+    cycle.Step();
+  }
+
+  RebuildPaletteLut();
+}
+
+// =============================================================================
+
+void BgImage::AdvancePaletteCycles(double dt)
+{
+  bool changed = false;
+
+  for (PaletteCycle& cycle : PaletteCycles)
+  {
+    if (cycle.Rate == 0)
+    {
+      continue;
+    }
+
+    //
+    // Time left over after a shift counts towards the next one, so rate
+    // doesn't depend on how the period lines up with dt, and a cycle
+    // faster than the tick rate shifts several times per tick.
+    // Period is shortened by a hair, so that rounding error of summed dt
+    // doesn't make a shift that's due exactly now wait one more tick.
+    //
+    const double period = 1.0 / (double)cycle.Rate;
+
+    cycle.TimeAcc += dt;
+
+    uint32_t oldOffset = cycle.Offset;
+
+    while (cycle.TimeAcc >= period * (1.0 - 1e-9))
+    {
+      cycle.TimeAcc -= period;
+
+      cycle.Step();
+    }
+
+    changed |= (cycle.Offset != oldOffset);
+  }
+
+  if (changed)
+  {
+    RebuildPaletteLut();
+  }
+}
+
+// =============================================================================
+
+uint32_t BgImage::CycledPaletteIndex(uint32_t index) const
+{
+  uint32_t res = index;
+
+  for (const PaletteCycle& cycle : PaletteCycles)
+  {
+    if (index >= cycle.Start and index <= cycle.End)
+    {
+      res = cycle.Start + (index - cycle.Start + cycle.Offset) % cycle.Length();
+    }
+  }
+
+  return res;
+}
+
+// =============================================================================
+
+void BgImage::RebuildPaletteLut()
+{
+  const size_t paletteSize = PaletteColorByIndex.size();
+
+  for (size_t i = 0; i < kPaletteLutSize; i++)
+  {
+    if (i < paletteSize)
+    {
+      PaletteLut[i] = PackRGBA32(PaletteColorByIndex[CycledPaletteIndex(i)]);
+    }
+    else
+    {
+      PaletteLut[i] = 0;
+    }
+  }
+
+  for (size_t i = 0; i < kPaletteLutSize; i++)
+  {
+    if (i < Colors.size())
+    {
+      uint8_t entry = PaletteEntryByColor[i];
+
+      ColorLut[i] = (entry == kNotInPalette) ? Colors[i] : PaletteLut[entry];
+    }
+    else
+    {
+      ColorLut[i] = 0;
+    }
+  }
+}
+
+// =============================================================================
+
+namespace
+{
+  //
+  // Every parameter is optional, missing ones keep their defaults.
+  //
+  void LoadDistortion(NRS& n,
+                      const std::string& fname,
+                      Distortion& d)
+  {
+    if (n.Has("type"))
+    {
+      const std::string name(n["type"].GetString());
+
+      if (not DistortionTypeFromName(name, d.Type))
+      {
+        SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                    "'%s' - unknown distortion type '%s'",
+                    fname.data(), name.data());
+      }
+    }
+
+    auto Read = [&n, &fname](const std::string& name, double& value)
+    {
+      if (not n.Has(name))
+      {
+        return;
+      }
+
+      std::optional<double> v = n[name].TryGetDouble();
+      if (v.has_value())
+      {
+        value = *v;
+      }
+      else
+      {
+        SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                    "'%s' - distortion '%s' is not a number, ignored",
+                    fname.data(), name.data());
+      }
+    };
+
+    Read("amplitude",               d.Amplitude);
+    Read("frequency",               d.Frequency);
+    Read("compression",             d.Compression);
+    Read("speed",                   d.Speed);
+    Read("amplitudeAcceleration",   d.AmplitudeAcceleration);
+    Read("frequencyAcceleration",   d.FrequencyAcceleration);
+    Read("compressionAcceleration", d.CompressionAcceleration);
+  }
+
+  // ===========================================================================
+
+  //
+  // Every child is one cycle, e.g. "1 : { start : 1, end : 4, rate : 15 }".
+  // Start and end are 1 based like palette colors and inclusive, mode is
+  // optional and forward by default.
+  //
+  void LoadPaletteCycles(NRS& n,
+                         const std::string& fname,
+                         BgImage& image)
+  {
+    const size_t paletteSize = image.PaletteColorByIndex.size();
+
+    for (size_t i = 0; i < n.ChildrenCount(); i++)
+    {
+      std::string ind = std::to_string(i + 1);
+
+      NRS* found = n.Find(ind);
+      if (found == nullptr)
+      {
+        continue;
+      }
+
+      NRS& c = *found;
+
+      if (not c.Has("start") or not c.Has("end") or not c.Has("rate"))
+      {
+        SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                    "'%s' - cycle %s needs start, end and rate, skipped",
+                    fname.data(), ind.data());
+        continue;
+      }
+
+      std::optional<int64_t> startValue = c["start"].TryGetInt();
+      std::optional<int64_t> endValue   = c["end"].TryGetInt();
+      std::optional<int64_t> rateValue  = c["rate"].TryGetInt();
+
+      if (not startValue or not endValue or not rateValue)
+      {
+        SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                    "'%s' - cycle %s has non integer start, end or rate, "
+                    "skipped",
+                    fname.data(), ind.data());
+        continue;
+      }
+
+      int64_t start = *startValue;
+      int64_t end   = *endValue;
+      int64_t rate  = *rateValue;
+
+      if (start < 1 or end < start or (size_t)end > paletteSize or rate < 0)
+      {
+        SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                    "'%s' - cycle %s is out of palette (%zu colors), skipped",
+                    fname.data(), ind.data(), paletteSize);
+        continue;
+      }
+
+      PaletteCycle cycle;
+      cycle.Start = start - 1;
+      cycle.End   = end - 1;
+      cycle.Rate  = rate;
+
+      if (c.Has("mode"))
+      {
+        const std::string mode(c["mode"].GetString());
+
+        bool modeFound = false;
+
+        for (size_t m = 0; m < (size_t)CycleMode::LAST_ELEMENT; m++)
+        {
+          if (mode == CycleModeName((CycleMode)m))
+          {
+            cycle.Mode = (CycleMode)m;
+            modeFound = true;
+            break;
+          }
+        }
+
+        if (not modeFound)
+        {
+          SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                      "'%s' - unknown cycle mode '%s', using forward",
+                      fname.data(), mode.data());
+        }
+      }
+
+      image.PaletteCycles.push_back(cycle);
+    }
+  }
+}
+
+// =============================================================================
+
+std::unique_ptr<BgImage> LoadImage(const std::string& fname)
+{
+  using namespace std::filesystem;
+
+  SDL_Surface* s = SDL_LoadBMP(fname.data());
+  if (s == nullptr)
+  {
+    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                "'%s' - failed to load image: %s",
+                fname.data(), SDL_GetError());
+    return nullptr;
+  }
+
+  if (s->w <= 0 or s->h <= 0
+   or (uint32_t)s->w > kMaxBgSize or (uint32_t)s->h > kMaxBgSize)
+  {
+    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                "'%s' - wrong image size %dx%d! Background images can't be "
+                "bigger than %ux%u. Skipping this one.",
+                fname.data(), s->w, s->h, kMaxBgSize, kMaxBgSize);
+    SDL_FreeSurface(s);
+    return nullptr;
+  }
+
+  //
+  // Pixels are read below as 3 bytes in B, G, R order, which is what
+  // 24 bit BMP loads as. Other depths (8 bit palettized, 16 or 32 bit)
+  // are converted to that first.
+  //
+  if (s->format->format != SDL_PIXELFORMAT_BGR24)
+  {
+    const int bitsPerPixel = s->format->BitsPerPixel;
+
+    SDL_Surface* converted = SDL_ConvertSurfaceFormat(s, SDL_PIXELFORMAT_BGR24, 0);
+
+    SDL_FreeSurface(s);
+
+    if (converted == nullptr)
+    {
+      SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                  "'%s' - failed to convert %d bit image to 24 bit: %s. "
+                  "Skipping this one.",
+                  fname.data(), bitsPerPixel, SDL_GetError());
+      return nullptr;
+    }
+
+    s = converted;
+  }
+
+  std::unique_ptr<BgImage> image = std::make_unique<BgImage>();
+
+  image->Fname = fname;
+
+  const uint32_t width  = s->w;
+  const uint32_t height = s->h;
+
+  std::vector<uint32_t> pixels((size_t)width * height);
+
+  for (uint32_t y = 0; y < height; y++)
+  {
+    const uint8_t* row = (const uint8_t*)s->pixels + (size_t)y * s->pitch;
+
+    for (uint32_t x = 0; x < width; x++)
+    {
+      SDL_Color c;
+      c.r = row[x * 3 + 2];
+      c.g = row[x * 3 + 1];
+      c.b = row[x * 3];
+      c.a = 255;
+
+      pixels[(size_t)y * width + x] = PackRGBA32(c);
+    }
+  }
+
+  image->SetPixels(width, height, std::move(pixels));
+
+  SDL_FreeSurface(s);
+
+  auto spl = StringSplit(fname, '.');
+
+  std::string imgDataFname = spl[0] + ".txt";
+
+  path p{imgDataFname};
+
+  if (not exists(p))
+  {
+    SDL_Log("'%s' - no accompanying data file found.",
+            fname.data());
+    return image;
+  }
+
+  if (not is_regular_file(p))
+  {
+    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                "'%s' - not a regular file!",
+                p.c_str());
+    return image;
+  }
+
+  NRS r;
+
+  NRS::LoadResult lr = r.Load(imgDataFname);
+  if (lr != NRS::LoadResult::LOAD_OK)
+  {
+    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                "'%s' - failed to parse image data file: %s",
+                imgDataFname.data(), NRS::LoadResultToString(lr));
+    return image;
+  }
+
+  if (r.Has("distortion"))
+  {
+    LoadDistortion(r["distortion"], imgDataFname, image->LoadedDistortion);
+
+    image->CurrentDistortion = image->LoadedDistortion;
+  }
+
+  if (not r.Has("palette"))
+  {
+    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                "'palette' section was not found - palette information "
+                "will be ignored");
+    return image;
+  }
+
+  NRS& pn = r["palette"];
+
+  if (not pn.Has("colors"))
+  {
+    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                "No color information was found in 'palette' section!");
+    return image;
+  }
+
+  NRS& n = r.GetNode("palette.colors");
+
+  size_t itemsCount = n.ChildrenCount();
+  if (itemsCount > kMaxPaletteSize)
+  {
+    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                "'%s' - palette has %zu colors, only first %zu will be used",
+                imgDataFname.data(), itemsCount, kMaxPaletteSize);
+    itemsCount = kMaxPaletteSize;
+  }
+
+  for (size_t i = 0; i < itemsCount; i++)
+  {
+    std::string ind = std::to_string(i + 1);
+
+    const NRS* color = n.Find(ind);
+
+    std::optional<NRS::RGB> rgb = (color != nullptr)
+                                ? color->TryGetRGB()
+                                : std::nullopt;
+    if (not rgb.has_value())
+    {
+      SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                  "'%s' - palette color %s is not three values 0 - 255, "
+                  "using black",
+                  imgDataFname.data(), ind.data());
+    }
+
+    NRS::RGB c = rgb.value_or(NRS::RGB());
+
+    SDL_Color pc;
+    pc.r = c.R;
+    pc.g = c.G;
+    pc.b = c.B;
+
+    image->PaletteColorByIndex.push_back(pc);
+  }
+
+  if (not image->PaletteColorByIndex.empty())
+  {
+    image->ConstructPaletteMap();
+  }
+  else
+  {
+    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                "No data was found in palette section!");
+  }
+
+  if (pn.Has("cycles"))
+  {
+    LoadPaletteCycles(pn["cycles"], imgDataFname, *image);
+  }
+  else
+  {
+    //
+    // Old style single cycle over the whole palette.
+    //
+    PaletteCycle cycle;
+    cycle.End = image->PaletteColorByIndex.size() - 1;
+
+    if (not pn.Has("cycleRate"))
+    {
+      SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                  "'cycleRate' is not present - assuming 0");
+    }
+    else
+    {
+      cycle.Rate = (uint32_t)pn["cycleRate"].GetUInt();
+    }
+
+    if (pn.Has("pingPong") and pn["pingPong"].TryGetBool().value_or(false))
+    {
+      cycle.Mode = CycleMode::PING_PONG;
+    }
+
+    if (not image->PaletteColorByIndex.empty())
+    {
+      image->PaletteCycles.push_back(cycle);
+    }
+  }
+
+  //SDL_Log("%s", image->ToString().data());
+
+  return image;
+}
+
+// =============================================================================
+
+std::vector<std::unique_ptr<BgImage>> LoadImages(const std::vector<std::string>& fnames,
+                                                 ThreadPool& pool)
+{
+  //
+  // Every job writes only into its own slot, so no locking is needed and
+  // order doesn't depend on which thread finished first.
+  //
+  std::vector<std::unique_ptr<BgImage>> loaded(fnames.size());
+
+  pool.ParallelFor(fnames.size(), [&fnames, &loaded](size_t i)
+  {
+    loaded[i] = LoadImage(fnames[i]);
+  });
+
+  std::vector<std::unique_ptr<BgImage>> res;
+  res.reserve(loaded.size());
+
+  for (auto& image : loaded)
+  {
+    if (image != nullptr)
+    {
+      res.push_back(std::move(image));
+    }
+  }
+
+  return res;
+}
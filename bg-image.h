@@ -0,0 +1,306 @@
+#ifndef BG_IMAGE_H
+#define BG_IMAGE_H
+
+#include <SDL2/SDL.h>
+
+#include "distortion.h"
+#include "palette-kernel.h"
+#include "thread-pool.h"
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+
+//
+// Source coordinates are stored as uint16_t (see OffsetTables).
+//
+const uint32_t kMaxBgSize = 65536;
+
+//
+// See CoordWrap.
+//
+const size_t kWrapTableSpan = 4;
+
+//
+// Palette indices are stored as uint8_t and kNotInPalette marks pixels whose
+// color is not in palette, so there can be at most 255 palette colors.
+//
+const size_t  kMaxPaletteSize = 255;
+const uint8_t kNotInPalette   = 255;
+
+//
+// Images with more unique colors than this are stored as true color.
+//
+const size_t kMaxIndexedColors = 256;
+
+const size_t kIndexPlanePadding = 4;
+
+// =============================================================================
+
+//
+// SDL_PIXELFORMAT_RGBA32 is byte ordered, so on little endian it's ABGR8888.
+//
+inline uint32_t PackRGBA32(const SDL_Color& c)
+{
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+  return ((uint32_t)c.r << 24) | ((uint32_t)c.g << 16) | ((uint32_t)c.b << 8) | 0xFFu;
+#else
+  return 0xFF000000u | ((uint32_t)c.b << 16) | ((uint32_t)c.g << 8) | (uint32_t)c.r;
+#endif
+}
+
+// =============================================================================
+
+inline SDL_Color UnpackRGBA32(uint32_t value)
+{
+  //
+  // RGBA32 is byte ordered regardless of endianness.
+  //
+  const uint8_t* bytes = (const uint8_t*)&value;
+
+  SDL_Color c;
+  c.r = bytes[0];
+  c.g = bytes[1];
+  c.b = bytes[2];
+  c.a = bytes[3];
+
+  return c;
+}
+
+// =============================================================================
+
+//
+// RGBA32 color (alpha is always 255) to index, so that color can be found
+// among others in O(1) instead of linear search.
+//
+using ColorIndexMap = std::unordered_map<uint32_t, uint32_t>;
+
+// =============================================================================
+
+//
+// Wraps coordinate into [0, Size) without division in the common case.
+// Power of two sizes are wrapped with a bitmask. Others are wrapped with
+// a table lookup, which covers coordinates below kWrapTableSpan * Size
+// (scroll position + scanline offset + pixel position stays within that
+// unless scanline factor is bigger than the image), with modulo after that.
+//
+struct CoordWrap
+{
+  uint32_t Size = 0;
+  uint32_t Mask = 0;
+
+  std::vector<uint16_t> Table;
+
+  void Init(uint32_t size);
+
+  inline uint16_t operator()(size_t coord) const
+  {
+    if (Mask != 0)
+    {
+      return coord & Mask;
+    }
+
+    return (coord < Table.size()) ? Table[coord] : (coord % Size);
+  }
+};
+
+// =============================================================================
+
+//
+// Palette entries Start..End (inclusive) rotate by one every 1 / Rate
+// seconds. FORWARD takes colors from higher entries, REVERSE from lower
+// ones, PING_PONG goes forward until offset reaches the end of range and
+// then back to zero.
+//
+enum class CycleMode
+{
+  FORWARD = 0,
+  REVERSE,
+  PING_PONG,
+  LAST_ELEMENT
+};
+
+struct PaletteCycle
+{
+  uint32_t Start = 0;
+  uint32_t End   = 0;
+  uint32_t Rate  = 0;
+
+  CycleMode Mode = CycleMode::FORWARD;
+
+  uint32_t Offset = 0;
+
+  bool MovingBack = false;
+
+  //
+  // Time passed since last shift.
+  //
+  double TimeAcc = 0.0;
+
+  // ---------------------------------------------------------------------------
+
+  uint32_t Length() const
+  {
+    return End - Start + 1;
+  }
+
+  void Step();
+  void Reset();
+};
+
+// =============================================================================
+
+const char* CycleModeName(CycleMode mode);
+
+// =============================================================================
+
+struct BgImage
+{
+  SDL_Surface* OriginalImage = nullptr;
+  SDL_Surface* ImageToDraw   = nullptr;
+
+  uint32_t Width  = 0;
+  uint32_t Height = 0;
+
+  CoordWrap WrapX;
+  CoordWrap WrapY;
+
+  //
+  // Pixels are stored either as indexed or as true color image.
+  //
+  // Indexed (up to kMaxIndexedColors unique colors):
+  // Indices is Width x Height plane of indices into Colors table.
+  // PaletteEntryByColor tells which palette entry each of Colors is, or
+  // kNotInPalette.
+  //
+  // True color (everything else):
+  // TrueColor is Width x Height plane of RGBA32 values and
+  // PaletteIndices is the plane of palette entries (or kNotInPalette) for
+  // each pixel.
+  //
+  // Index planes have kIndexPlanePadding extra bytes at the end, so that
+  // kernels can read them with 32 bit loads.
+  //
+  std::vector<uint8_t>  Indices;
+  std::vector<uint32_t> Colors;
+  std::vector<uint8_t>  PaletteEntryByColor;
+
+  std::vector<uint32_t> TrueColor;
+  std::vector<uint8_t>  PaletteIndices;
+
+  int ScrollSpeedH = 0;
+  int ScrollSpeedV = 0;
+
+  size_t ScrollPosX = 0;
+  size_t ScrollPosY = 0;
+
+  int ScanlineOffsetX = 0;
+  int ScanlineOffsetY = 0;
+
+  //
+  // Distortion angles as 16.16 phase (see sine-lut.h).
+  //
+  uint32_t PhaseX = 0;
+  uint32_t PhaseY = 0;
+
+  double ScanlineFactorX = 0.0;
+  double ScanlineFactorY = 0.0;
+
+  //
+  // LoadedDistortion comes from 'distortion' section of data file,
+  // CurrentDistortion is the one that is animated and drawn, and goes back
+  // to LoadedDistortion on reset.
+  //
+  Distortion LoadedDistortion;
+  Distortion CurrentDistortion;
+
+  std::vector<SDL_Color> PaletteColorByIndex;
+
+  //
+  // Ranges of palette that cycle independently. Overlapping ranges are
+  // allowed, later one wins.
+  //
+  std::vector<PaletteCycle> PaletteCycles;
+
+  //
+  // PaletteColorByIndex with all cycles applied as RGBA32, so that
+  // PaletteLut[PaletteIndices[y][x]] is the color to draw.
+  // Entries past the palette are 0, which means "not in palette, use
+  // original pixel color" (see palette-kernel.h).
+  //
+  // ColorLut is the same thing for indexed images: ColorLut[Indices[y][x]]
+  // is the color to draw, with palette rotation already applied.
+  //
+  // Both are rebuilt by RebuildPaletteLut() only when some offset actually
+  // changes, so number of cycles doesn't affect per pixel cost.
+  //
+  uint32_t PaletteLut[kPaletteLutSize]{};
+  uint32_t ColorLut[kPaletteLutSize]{};
+
+  std::string Fname;
+
+  // ---------------------------------------------------------------------------
+
+  bool IsIndexed() const
+  {
+    return TrueColor.empty();
+  }
+
+  uint32_t GetPixel(uint32_t x, uint32_t y) const;
+  uint8_t  GetPaletteIndex(uint32_t x, uint32_t y) const;
+
+  //
+  // Picks indexed storage if image has few enough colors.
+  // Takes width x height plane of RGBA32 values.
+  //
+  void SetPixels(uint32_t width,
+                 uint32_t height,
+                 std::vector<uint32_t>&& pixels);
+
+  size_t MemoryUsed() const;
+
+  void ResetParams();
+  void RandomizeParams();
+
+  std::string GetColorDataString();
+  std::string ToString();
+
+  void ConstructPaletteMap();
+
+  //
+  // Shifts every cycle by one regardless of its rate.
+  //
+  void CyclePalette();
+
+  //
+  // Shifts cycles whose time has come, dt is in seconds.
+  //
+  void AdvancePaletteCycles(double dt);
+
+  //
+  // Palette entry that entry index shows with cycles applied.
+  //
+  uint32_t CycledPaletteIndex(uint32_t index) const;
+
+  void RebuildPaletteLut();
+};
+
+// =============================================================================
+
+//
+// Loads BMP (24 bit, or any other depth SDL can load, converted to 24 bit)
+// and its accompanying .txt palette data file if present.
+// Returns nullptr if image itself couldn't be loaded.
+//
+std::unique_ptr<BgImage> LoadImage(const std::string& fname);
+
+//
+// Loads images on all threads of the pool. Result is in the same order as
+// fnames, with the ones that failed to load left out.
+//
+std::vector<std::unique_ptr<BgImage>> LoadImages(const std::vector<std::string>& fnames,
+                                                 ThreadPool& pool);
+
+#endif // BG_IMAGE_H
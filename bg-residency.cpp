@@ -0,0 +1,228 @@
+#include "bg-residency.h"
+
+BgResidency::~BgResidency()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+
+  _wakeUp.notify_all();
+
+  if (_loader.joinable())
+  {
+    _loader.join();
+  }
+}
+
+// =============================================================================
+
+void BgResidency::Init(const std::vector<std::string>& fnames,
+                       size_t memoryBudget)
+{
+  _memoryBudget = memoryBudget;
+
+  _entries.resize(fnames.size());
+
+  for (size_t i = 0; i < fnames.size(); i++)
+  {
+    _entries[i].Fname = fnames[i];
+  }
+
+  _loader = std::thread(&BgResidency::LoaderLoop, this);
+}
+
+// =============================================================================
+
+size_t BgResidency::Count() const
+{
+  return _entries.size();
+}
+
+// =============================================================================
+
+const std::string& BgResidency::Fname(size_t index) const
+{
+  return _entries[index].Fname;
+}
+
+// =============================================================================
+
+BgImage* BgResidency::Get(size_t index)
+{
+  if (index >= _entries.size())
+  {
+    return nullptr;
+  }
+
+  Entry& e = _entries[index];
+
+  if (e.ResidencyState != State::RESIDENT)
+  {
+    return nullptr;
+  }
+
+  _lru.splice(_lru.begin(), _lru, e.LruPos);
+
+  return e.Image.get();
+}
+
+// =============================================================================
+
+bool BgResidency::IsFailed(size_t index) const
+{
+  return (index < _entries.size()
+      and _entries[index].ResidencyState == State::FAILED);
+}
+
+// =============================================================================
+
+void BgResidency::Request(size_t index)
+{
+  if (index >= _entries.size())
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (size_t queued : _queue)
+    {
+      _entries[queued].ResidencyState = State::NOT_LOADED;
+    }
+
+    _queue.clear();
+
+    size_t n = _entries.size();
+
+    Enqueue(index);
+    Enqueue((index + 1) % n);
+    Enqueue((index + n - 1) % n);
+  }
+
+  _wakeUp.notify_one();
+}
+
+// =============================================================================
+
+void BgResidency::Enqueue(size_t index)
+{
+  Entry& e = _entries[index];
+
+  if (e.ResidencyState == State::NOT_LOADED)
+  {
+    e.ResidencyState = State::QUEUED;
+    _queue.push_back(index);
+  }
+}
+
+// =============================================================================
+
+void BgResidency::Update(const std::vector<size_t>& pinned)
+{
+  std::vector<std::pair<size_t, std::unique_ptr<BgImage>>> finished;
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    finished.swap(_finished);
+  }
+
+  for (auto& item : finished)
+  {
+    Entry& e = _entries[item.first];
+
+    if (item.second == nullptr)
+    {
+      e.ResidencyState = State::FAILED;
+      continue;
+    }
+
+    e.Image = std::move(item.second);
+    e.ResidencyState = State::RESIDENT;
+
+    _lru.push_front(item.first);
+    e.LruPos = _lru.begin();
+
+    _memoryUsed += e.Image->MemoryUsed();
+  }
+
+  Evict(pinned);
+}
+
+// =============================================================================
+
+void BgResidency::Evict(const std::vector<size_t>& pinned)
+{
+  auto it = _lru.end();
+
+  while (_memoryUsed > _memoryBudget and it != _lru.begin())
+  {
+    --it;
+
+    size_t index = *it;
+
+    if (std::find(pinned.begin(), pinned.end(), index) != pinned.end())
+    {
+      continue;
+    }
+
+    Entry& e = _entries[index];
+
+    _memoryUsed -= e.Image->MemoryUsed();
+
+    SDL_Log("'%s' - evicted (%zu KiB resident)",
+            e.Fname.data(), _memoryUsed / 1024);
+
+    e.Image.reset();
+    e.ResidencyState = State::NOT_LOADED;
+
+    it = _lru.erase(it);
+  }
+}
+
+// =============================================================================
+
+size_t BgResidency::MemoryUsed() const
+{
+  return _memoryUsed;
+}
+
+// =============================================================================
+
+size_t BgResidency::ResidentCount() const
+{
+  return _lru.size();
+}
+
+// =============================================================================
+
+void BgResidency::LoaderLoop()
+{
+  while (true)
+  {
+    size_t index = 0;
+
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      _wakeUp.wait(lock, [this]() { return (_stop or not _queue.empty()); });
+
+      if (_stop)
+      {
+        return;
+      }
+
+      index = _queue.front();
+      _queue.pop_front();
+    }
+
+    //
+    // Fname is never modified after Init(), so it's safe to read it here.
+    //
+    std::unique_ptr<BgImage> image = LoadImage(_entries[index].Fname);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _finished.emplace_back(index, std::move(image));
+  }
+}
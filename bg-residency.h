@@ -0,0 +1,111 @@
+#ifndef BG_RESIDENCY_H
+#define BG_RESIDENCY_H
+
+#include "bg-image.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+
+//
+// Keeps only some of the backgrounds decoded.
+//
+// Library is just a list of file names. Images are decoded on demand on a
+// separate loader thread, and once total MemoryUsed() of decoded images
+// goes over the budget, least recently used ones are thrown away.
+//
+// Everything except the loader thread itself is supposed to be called from
+// the main thread only: images are handed over and evicted in Update(),
+// so pointer returned by Get() stays valid at least until next Update(),
+// and for as long as its index is passed to Update() among pinned ones.
+//
+class BgResidency
+{
+  public:
+    BgResidency() = default;
+    ~BgResidency();
+
+    BgResidency(const BgResidency&) = delete;
+    BgResidency& operator=(const BgResidency&) = delete;
+
+    //
+    // Starts loader thread. Must be called only once.
+    //
+    void Init(const std::vector<std::string>& fnames, size_t memoryBudget);
+
+    size_t Count() const;
+
+    const std::string& Fname(size_t index) const;
+
+    //
+    // Returns nullptr if image is not decoded yet (or couldn't be decoded).
+    // Marks image as most recently used otherwise.
+    //
+    BgImage* Get(size_t index);
+
+    bool IsFailed(size_t index) const;
+
+    //
+    // Drops everything that was queued before (since user has already
+    // moved on), then queues index and its neighbours, in that order.
+    //
+    void Request(size_t index);
+
+    //
+    // Takes finished images from the loader and evicts least recently used
+    // ones if over budget. Images at pinned indices are never evicted.
+    //
+    void Update(const std::vector<size_t>& pinned);
+
+    size_t MemoryUsed() const;
+    size_t ResidentCount() const;
+
+  private:
+    enum class State
+    {
+      NOT_LOADED = 0,
+      QUEUED,
+      RESIDENT,
+      FAILED
+    };
+
+    struct Entry
+    {
+      std::string Fname;
+      std::unique_ptr<BgImage> Image;
+      State ResidencyState = State::NOT_LOADED;
+      std::list<size_t>::iterator LruPos;
+    };
+
+    void Enqueue(size_t index);
+    void Evict(const std::vector<size_t>& pinned);
+    void LoaderLoop();
+
+    std::vector<Entry> _entries;
+
+    //
+    // Resident indices, most recently used first.
+    //
+    std::list<size_t> _lru;
+
+    size_t _memoryBudget = 0;
+    size_t _memoryUsed   = 0;
+
+    // -------------------------------------------------------------------------
+    // Shared with loader thread
+
+    std::mutex _mutex;
+    std::condition_variable _wakeUp;
+
+    std::deque<size_t> _queue;
+    std::vector<std::pair<size_t, std::unique_ptr<BgImage>>> _finished;
+
+    bool _stop = false;
+
+    std::thread _loader;
+};
+
+#endif // BG_RESIDENCY_H
@@ -0,0 +1,49 @@
+#include "distortion.h"
+#include "sine-lut.h"
+
+namespace
+{
+  const char* kTypeNames[] =
+  {
+    "none",
+    "horizontal",
+    "interlaced",
+    "vertical"
+  };
+}
+
+// =============================================================================
+
+void Distortion::Advance()
+{
+  Phase += DegreesToPhase(Speed);
+
+  Amplitude   += AmplitudeAcceleration;
+  Frequency   += FrequencyAcceleration;
+  Compression += CompressionAcceleration;
+}
+
+// =============================================================================
+
+const char* DistortionTypeName(DistortionType type)
+{
+  return ((size_t)type < (size_t)DistortionType::LAST_ELEMENT)
+         ? kTypeNames[(size_t)type]
+         : "???";
+}
+
+// =============================================================================
+
+bool DistortionTypeFromName(const std::string& name, DistortionType& type)
+{
+  for (size_t i = 0; i < (size_t)DistortionType::LAST_ELEMENT; i++)
+  {
+    if (name == kTypeNames[i])
+    {
+      type = (DistortionType)i;
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,82 @@
+#ifndef DISTORTION_H
+#define DISTORTION_H
+
+#include <cstdint>
+#include <string>
+
+//
+// Classic per scanline distortion. Offset of scanline Y is
+//
+//   S = Amplitude * sin(Frequency * Y + Phase)
+//
+// HORIZONTAL shifts row Y by S, HORIZONTAL_INTERLACED shifts even rows by S
+// and odd ones by -S, VERTICAL takes source row Y * (1 + Compression) + S
+// (compression above 0 squeezes image, below 0 stretches it).
+//
+// NONE is the original per pixel effect driven by ScanlineFactorX/Y.
+//
+enum class DistortionType
+{
+  NONE = 0,
+  HORIZONTAL,
+  HORIZONTAL_INTERLACED,
+  VERTICAL,
+  LAST_ELEMENT
+};
+
+// =============================================================================
+
+struct Distortion
+{
+  DistortionType Type = DistortionType::NONE;
+
+  //
+  // Pixels.
+  //
+  double Amplitude = 16.0;
+
+  //
+  // Degrees per scanline.
+  //
+  double Frequency = 2.8;
+
+  //
+  // Source rows per output row minus one.
+  //
+  double Compression = 0.0;
+
+  //
+  // Degrees per frame Phase advances by.
+  //
+  double Speed = 3.0;
+
+  //
+  // Added to the corresponding value every frame.
+  //
+  double AmplitudeAcceleration   = 0.0;
+  double FrequencyAcceleration   = 0.0;
+  double CompressionAcceleration = 0.0;
+
+  //
+  // 16.16 phase (see sine-lut.h).
+  //
+  uint32_t Phase = 0;
+
+  // ---------------------------------------------------------------------------
+
+  //
+  // Moves everything one frame forward.
+  //
+  void Advance();
+};
+
+// =============================================================================
+
+const char* DistortionTypeName(DistortionType type);
+
+//
+// Inverse of DistortionTypeName(), returns false on unknown name.
+//
+bool DistortionTypeFromName(const std::string& name, DistortionType& type);
+
+#endif // DISTORTION_H
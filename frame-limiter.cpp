@@ -0,0 +1,50 @@
+#include "frame-limiter.h"
+
+#include <thread>
+
+FrameLimiter::FrameLimiter(double rate)
+{
+  SetRate(rate);
+}
+
+// =============================================================================
+
+void FrameLimiter::SetRate(double rate)
+{
+  _period = (rate > 0.0)
+          ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate))
+          : Clock::duration{0};
+
+  _deadline = Clock::now() + _period;
+}
+
+// =============================================================================
+
+void FrameLimiter::Wait()
+{
+  if (_period == Clock::duration{0})
+  {
+    return;
+  }
+
+  Clock::time_point now = Clock::now();
+
+  if (now < _deadline - kSpinThreshold)
+  {
+    std::this_thread::sleep_for(_deadline - kSpinThreshold - now);
+  }
+
+  while (Clock::now() < _deadline)
+  {
+    std::this_thread::yield();
+  }
+
+  _deadline += _period;
+
+  now = Clock::now();
+
+  if (now > _deadline)
+  {
+    _deadline = now + _period;
+  }
+}
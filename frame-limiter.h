@@ -0,0 +1,41 @@
+#ifndef FRAME_LIMITER_H
+#define FRAME_LIMITER_H
+
+#include <chrono>
+
+//
+// Keeps loop at fixed rate without relying on vsync.
+// OS sleep is only accurate to a millisecond or so (much worse on some
+// systems), so Wait() sleeps until kSpinThreshold before the deadline and
+// spins the rest of the way.
+//
+// Deadlines are kept on a fixed grid, so an occasional late frame doesn't
+// shift all following ones, but if loop falls behind by more than a whole
+// period, the grid restarts from now instead of rushing to catch up.
+//
+class FrameLimiter
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    //
+    // Frames per second, 0 means no limit.
+    //
+    explicit FrameLimiter(double rate = 0.0);
+
+    void SetRate(double rate);
+
+    //
+    // Returns once current frame has taken its full period.
+    //
+    void Wait();
+
+  private:
+    static constexpr std::chrono::microseconds kSpinThreshold{1000};
+
+    Clock::duration _period{0};
+
+    Clock::time_point _deadline;
+};
+
+#endif // FRAME_LIMITER_H
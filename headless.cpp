@@ -0,0 +1,304 @@
+#include "headless.h"
+#include "bg-image.h"
+#include "bg-effect.h"
+#include "sine-lut.h"
+#include "util.h"
+#include "nrs.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  // ===========================================================================
+
+  bool ApplyParamsFile(const std::string& fname,
+                       BgImage& bg,
+                       HeadlessParams& params)
+  {
+    NRS n;
+
+    NRS::LoadResult lr = n.Load(fname);
+    if (lr != NRS::LoadResult::LOAD_OK)
+    {
+      SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                   "'%s' - failed to load parameters: %s",
+                   fname.data(), NRS::LoadResultToString(lr));
+      return false;
+    }
+
+    if (not n.Has("params"))
+    {
+      SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                   "'%s' - 'params' section was not found!",
+                   fname.data());
+      return false;
+    }
+
+    NRS& p = n["params"];
+
+    //
+    // Every parameter is optional, missing ones keep their current value,
+    // and so do the ones that aren't numbers.
+    //
+    auto ReadInt = [&p, &fname](const std::string& name, int& value)
+    {
+      if (not p.Has(name))
+      {
+        return;
+      }
+
+      std::optional<int64_t> v = p[name].TryGetInt();
+      if (v.has_value())
+      {
+        value = (int)*v;
+      }
+      else
+      {
+        SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                    "'%s' - '%s' is not an integer, ignored",
+                    fname.data(), name.data());
+      }
+    };
+
+    auto ReadDouble = [&p, &fname](const std::string& name, double& value)
+    {
+      if (not p.Has(name))
+      {
+        return;
+      }
+
+      std::optional<double> v = p[name].TryGetDouble();
+      if (v.has_value())
+      {
+        value = *v;
+      }
+      else
+      {
+        SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
+                    "'%s' - '%s' is not a number, ignored",
+                    fname.data(), name.data());
+      }
+    };
+
+    ReadInt("scrollSpeedH", bg.ScrollSpeedH);
+    ReadInt("scrollSpeedV", bg.ScrollSpeedV);
+
+    ReadDouble("scanlineFactorX", bg.ScanlineFactorX);
+    ReadDouble("scanlineFactorY", bg.ScanlineFactorY);
+    ReadDouble("angleIncreaseX",  params.AngleIncreaseX);
+    ReadDouble("angleIncreaseY",  params.AngleIncreaseY);
+
+    return true;
+  }
+
+  // ===========================================================================
+
+  bool SaveFrameBMP(const uint32_t* pixels,
+                    uint32_t width,
+                    uint32_t height,
+                    const std::string& fname)
+  {
+    SDL_Surface* s = SDL_CreateRGBSurfaceWithFormatFrom((void*)pixels,
+                                                        width,
+                                                        height,
+                                                        32,
+                                                        width * sizeof(uint32_t),
+                                                        SDL_PIXELFORMAT_RGBA32);
+    if (s == nullptr)
+    {
+      SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                   "Failed to create surface: %s",
+                   SDL_GetError());
+      return false;
+    }
+
+    int res = SDL_SaveBMP(s, fname.data());
+
+    SDL_FreeSurface(s);
+
+    if (res != 0)
+    {
+      SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                   "'%s' - failed to save frame: %s",
+                   fname.data(), SDL_GetError());
+      return false;
+    }
+
+    return true;
+  }
+}
+
+// =============================================================================
+
+int RunHeadless(HeadlessParams params)
+{
+  if (params.BgFname.empty())
+  {
+    SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                 "Headless mode needs background file (--bg)");
+    return 1;
+  }
+
+  if (not std::isfinite(params.FrameRate) or params.FrameRate <= 0.0)
+  {
+    SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                 "Frame rate (--frame-rate) must be greater than zero");
+    return 1;
+  }
+
+  std::unique_ptr<BgImage> bg = LoadImage(params.BgFname);
+  if (bg == nullptr)
+  {
+    return 1;
+  }
+
+  if (params.UseSeed)
+  {
+    RNG.seed(params.Seed);
+
+    params.AngleIncreaseX = ::Random01();
+    params.AngleIncreaseY = ::Random01();
+
+    bg->RandomizeParams();
+  }
+
+  if (not params.ParamsFname.empty()
+  and not ApplyParamsFile(params.ParamsFname, *bg, params))
+  {
+    return 1;
+  }
+
+  FILE* raw = nullptr;
+
+  if (params.Format != HeadlessFormat::NONE)
+  {
+    std::error_code ec;
+    std::filesystem::create_directories(params.OutputDir, ec);
+    if (ec)
+    {
+      SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                   "'%s' - failed to create output directory: %s",
+                   params.OutputDir.data(), ec.message().data());
+      return 1;
+    }
+  }
+
+  if (params.Format == HeadlessFormat::RAW)
+  {
+    std::string fname = params.OutputDir + "/frames.rgba";
+
+    raw = std::fopen(fname.data(), "wb");
+    if (raw == nullptr)
+    {
+      SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                   "'%s' - failed to open for writing",
+                   fname.data());
+      return 1;
+    }
+  }
+
+  OffsetTables tables;
+
+  std::vector<uint32_t> pixels((size_t)bg->Width * bg->Height);
+
+  ThreadPool pool(params.ThreadsCount);
+
+  uint32_t phaseIncX = DegreesToPhase(params.AngleIncreaseX);
+  uint32_t phaseIncY = DegreesToPhase(params.AngleIncreaseY);
+
+  double frameTime = 1.0 / params.FrameRate;
+
+  Clock::duration renderTime{0};
+
+  Clock::time_point tpStart = Clock::now();
+
+  bool ok = true;
+
+  for (size_t frame = 0; frame < params.FramesCount and ok; frame++)
+  {
+    Clock::time_point t0 = Clock::now();
+
+    RenderParallel(*bg, phaseIncX, phaseIncY, tables, pixels.data(), pool);
+
+    renderTime += Clock::now() - t0;
+
+    switch (params.Format)
+    {
+      case HeadlessFormat::RAW:
+      {
+        size_t written = std::fwrite(pixels.data(),
+                                     sizeof(uint32_t),
+                                     pixels.size(),
+                                     raw);
+        if (written != pixels.size())
+        {
+          SDL_LogError(SDL_LOG_PRIORITY_ERROR, "Failed to write frame data");
+          ok = false;
+        }
+      }
+      break;
+
+      case HeadlessFormat::BMP:
+      {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/frame_%05zu.bmp", frame);
+
+        ok = SaveFrameBMP(pixels.data(),
+                          bg->Width,
+                          bg->Height,
+                          params.OutputDir + name);
+      }
+      break;
+
+      default:
+        break;
+    }
+
+    AdvanceBackground(*bg,
+                      phaseIncX,
+                      phaseIncY,
+                      bg->Width,
+                      bg->Height,
+                      frameTime);
+  }
+
+  if (raw != nullptr and std::fclose(raw) != 0)
+  {
+    SDL_LogError(SDL_LOG_PRIORITY_ERROR, "Failed to write frame data");
+    ok = false;
+  }
+
+  if (not ok)
+  {
+    return 1;
+  }
+
+  using seconds = std::chrono::duration<double>;
+
+  double total  = seconds(Clock::now() - tpStart).count();
+  double render = seconds(renderTime).count();
+
+  double frames = (double)params.FramesCount;
+  double pixelsTotal = frames * bg->Width * bg->Height;
+
+  SDL_Log("Rendered %zu frames of '%s' (%ux%u) in %.3f s (%zu threads)",
+          params.FramesCount, params.BgFname.data(),
+          bg->Width, bg->Height, total,
+          pool.ThreadsCount());
+
+  if (params.FramesCount != 0)
+  {
+    SDL_Log("render: %.0f ns/frame, %.1f Mpx/s",
+            render * 1e9 / frames, pixelsTotal / render / 1e6);
+    SDL_Log("total:  %.0f ns/frame (%.1f fps)",
+            total * 1e9 / frames, frames / total);
+  }
+
+  return 0;
+}
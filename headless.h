@@ -0,0 +1,73 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//
+// Offline rendering of one background without window or renderer:
+// runs the same BuildOffsetTables() / Gather() / AdvanceBackground()
+// pipeline as the main loop, as fast as CPU allows, and writes every frame
+// to disk.
+//
+enum class HeadlessFormat
+{
+  //
+  // All frames one after another into single <OutputDir>/frames.rgba,
+  // RGBA32 of background image size each.
+  //
+  RAW = 0,
+  //
+  // <OutputDir>/frame_00000.bmp and so on.
+  //
+  BMP,
+  //
+  // Nothing is written, useful for measuring throughput.
+  //
+  NONE
+};
+
+struct HeadlessParams
+{
+  std::string BgFname;
+
+  //
+  // NRS file with "params" section, see README.md.
+  //
+  std::string ParamsFname;
+
+  std::string OutputDir = "frames";
+
+  HeadlessFormat Format = HeadlessFormat::RAW;
+
+  size_t FramesCount = 600;
+
+  //
+  // Simulated frame rate, affects palette cycling speed only, since scroll
+  // and distortion angles advance per frame.
+  //
+  double FrameRate = 60.0;
+
+  //
+  // If set, parameters are randomized the same way 'R' does, with RNG
+  // seeded by this value. Applied before ParamsFname.
+  //
+  bool UseSeed = false;
+  uint64_t Seed = 0;
+
+  //
+  // Rendering threads, 0 means one per hardware thread.
+  //
+  size_t ThreadsCount = 0;
+
+  double AngleIncreaseX = 0.05;
+  double AngleIncreaseY = 0.05;
+};
+
+//
+// Returns process exit code.
+//
+int RunHeadless(HeadlessParams params);
+
+#endif // HEADLESS_H
@@ -156,6 +156,12 @@ class IF
 
     // -------------------------------------------------------------------------
 
+    //
+    // Glyphs are not drawn right away, but collected into one vertex buffer
+    // with color per vertex, and drawn with single SDL_RenderGeometry() call
+    // by Flush(). Anything else drawn in between (or changing render target
+    // or clip rect) should call Flush() first to keep the order.
+    //
     void Print(int x, int y,
                const std::string& text,
                uint32_t color = 0xFFFFFF,
@@ -168,11 +174,7 @@ class IF
         return;
       }
 
-      SaveColor();
-
-      const auto& clr = HTML2RGB(color);
-
-      SDL_SetTextureColorMod(_fontAtlas, clr.r, clr.g, clr.b);
+      const SDL_Color& clr = HTML2RGB(color);
 
       size_t ln = text.length();
 
@@ -198,6 +200,16 @@ class IF
         // --------------------------
       }
 
+      _vertices.reserve(_vertices.size() + ln * 4);
+      _indices.reserve(_indices.size() + ln * 6);
+
+      const float u = (float)_fontSize / (float)_atlasWidth;
+      const float v = (float)_fontSize / (float)_atlasHeight;
+
+      const int glyphSize = (int)( (double)_fontSize * scaleFactor );
+
+      int scaled = (int)( (double)(xOffset * _fontSize) * scaleFactor );
+
       for (char c : text)
       {
         size_t charInd = c - 32;
@@ -210,28 +222,101 @@ class IF
         size_t xx = (charInd % _numTilesH);
         size_t yy = (charInd / _numTilesH);
 
-        static SDL_Rect fromAtlas;
+        float u0 = xx * u;
+        float v0 = yy * v;
+
+        float x0 = (float)(x + scaled);
+        float y0 = (float)y;
+        float x1 = x0 + glyphSize;
+        float y1 = y0 + glyphSize;
+
+        int first = (int)_vertices.size();
+
+        _vertices.push_back({ { x0, y0 }, clr, { u0,     v0     } });
+        _vertices.push_back({ { x1, y0 }, clr, { u0 + u, v0     } });
+        _vertices.push_back({ { x1, y1 }, clr, { u0 + u, v0 + v } });
+        _vertices.push_back({ { x0, y1 }, clr, { u0,     v0 + v } });
+
+        _indices.push_back(first);
+        _indices.push_back(first + 1);
+        _indices.push_back(first + 2);
+        _indices.push_back(first);
+        _indices.push_back(first + 2);
+        _indices.push_back(first + 3);
+
+        x += glyphSize;
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    //
+    // Draws everything Print() has collected so far.
+    // Returns number of glyphs drawn.
+    //
+    size_t Flush()
+    {
+      if (_indices.empty())
+      {
+        return 0;
+      }
+
+      size_t glyphs = _indices.size() / 6;
+
+      int res = SDL_RenderGeometry(_rendererRef,
+                                   _fontAtlas,
+                                   _vertices.data(),
+                                   (int)_vertices.size(),
+                                   _indices.data(),
+                                   (int)_indices.size());
+      if (res < 0)
+      {
+        SDL_Log("%s", SDL_GetError());
+      }
+
+      _vertices.clear();
+      _indices.clear();
 
-        fromAtlas.x = xx * _fontSize;
-        fromAtlas.y = yy * _fontSize;
+      return glyphs;
+    }
 
-        fromAtlas.w = _fontSize;
-        fromAtlas.h = _fontSize;
+    // -------------------------------------------------------------------------
 
-        int scaled = (int)( (double)(xOffset * _fontSize) * scaleFactor );
+    //
+    // Screen area that Print() with the same arguments covers.
+    //
+    SDL_Rect TextBounds(int x, int y,
+                        const std::string& text,
+                        TextAlignment align = TextAlignment::LEFT,
+                        double scaleFactor = 1.0)
+    {
+      int ln = text.length();
 
-        static SDL_Rect dst;
-        dst.x = x + scaled;
-        dst.y = y;
-        dst.w = (int)( (double)_fontSize * scaleFactor );
-        dst.h = (int)( (double)_fontSize * scaleFactor );
+      int xOffset = 0;
 
-        SDL_RenderCopy(_rendererRef, _fontAtlas, &fromAtlas, &dst);
+      switch (align)
+      {
+        case TextAlignment::RIGHT:
+          xOffset = -ln;
+          break;
+
+        case TextAlignment::CENTER:
+          xOffset = -(ln / 2);
+          break;
 
-        x += (int)( (double)_fontSize * scaleFactor );
+        default:
+          break;
       }
 
-      RestoreColor();
+      int glyphSize = (int)( (double)_fontSize * scaleFactor );
+
+      SDL_Rect r;
+      r.x = x + (int)( (double)(xOffset * _fontSize) * scaleFactor );
+      r.y = y;
+      r.w = glyphSize * ln;
+      r.h = glyphSize;
+
+      return r;
     }
 
     // -------------------------------------------------------------------------
@@ -303,31 +388,18 @@ class IF
 
     // -------------------------------------------------------------------------
 
-    void SaveColor()
-    {
-      SDL_GetTextureColorMod(_fontAtlas,
-                             &_oldColor.r,
-                             &_oldColor.g,
-                             &_oldColor.b);
-    }
-
-    // -------------------------------------------------------------------------
-
-    void RestoreColor()
-    {
-      SDL_SetTextureColorMod(_fontAtlas,
-                             _oldColor.r,
-                             _oldColor.g,
-                             _oldColor.b);
-    }
-
     const uint32_t _maskR = 0x00FF0000;
     const uint32_t _maskG = 0x0000FF00;
     const uint32_t _maskB = 0x000000FF;
     const uint32_t _maskA = 0xFF000000;
 
     SDL_Color _drawColor;
-    SDL_Color _oldColor;
+
+    //
+    // Glyph quads waiting for Flush().
+    //
+    std::vector<SDL_Vertex> _vertices;
+    std::vector<int>        _indices;
 
     bool _initialized = false;
 
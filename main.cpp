@@ -1,58 +1,41 @@
 #include <filesystem>
 #include <vector>
 #include <memory>
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstdio>
 #include <set>
-#include <random>
 
 #include "instant-font.h"
 #include "nrs.h"
+#include "util.h"
+#include "sine-lut.h"
+#include "bg-image.h"
+#include "bg-effect.h"
+#include "thread-pool.h"
+#include "bg-residency.h"
+#include "headless.h"
+#include "frame-limiter.h"
 
 // =============================================================================
 
-std::mt19937_64 RNG;
-
-double Random01()
-{
-  return (double)(RNG() % 10001) / 10000.0;
-}
-
-// -----------------------------------------------------------------------------
-
-int RandomRange(int min, int max)
-{
-  if (min == max)
-  {
-    return min;
-  }
-
-  int trueMin = std::min(min, max);
-  int trueMax = std::max(min, max);
-
-  int d = std::abs(trueMax - trueMin);
-
-  int random = RNG() % d;
-
-  return trueMin + random;
-}
-
-// =============================================================================
-
-const double PIOVER180 = 0.017453292519943295;
-
 using Clock = std::chrono::steady_clock;
 using ns    = std::chrono::nanoseconds;
 
 SDL_Renderer* Renderer = nullptr;
 
 SDL_Texture* BgRenderTexture = nullptr;
+SDL_Texture* BgStreamTexture = nullptr;
 SDL_Texture* Framebuffer     = nullptr;
 
-const uint16_t kBgWidth  = 256;
-const uint16_t kBgHeight = 256;
-
-const uint16_t kBgW2 = kBgWidth * 2;
-const uint16_t kBgH2 = kBgHeight * 2;
+//
+// Screen area background is drawn into. Backgrounds of any size are scaled
+// to fit it, keeping aspect ratio (256x256 ones are just scaled 2x).
+//
+const uint16_t kBgDisplayW = 512;
+const uint16_t kBgDisplayH = 512;
 
 const uint16_t kScreenWidth  = 800;
 const uint16_t kScreenHeight = 600;
@@ -60,7 +43,7 @@ const uint16_t kScreenHeight = 600;
 const uint16_t kScreenWH = kScreenWidth / 2;
 const uint16_t kScreenHH = kScreenHeight / 2;
 
-const uint16_t kBgDisplayX = kScreenWidth - kBgW2 - 16;
+const uint16_t kBgDisplayX = kScreenWidth - kBgDisplayW - 16;
 const uint16_t kBgDisplayY = 16;
 
 uint32_t FPS = 0;
@@ -72,9 +55,89 @@ bool ShowHelp = false;
 
 NRS DataLoader;
 
-double AngleX = 0.0;
-double AngleY = 0.0;
+//
+// Background is always rendered into CPU side BgPixels first.
+// DRAW_POINTS is the original way of getting it on screen: one
+// SDL_RenderDrawPoint() per pixel into BgRenderTexture. FRAMEBUFFER uploads
+// the whole buffer into streaming texture once per frame.
+// Can be selected at startup with "--draw-points" / "--framebuffer".
+//
+enum class RenderMode
+{
+  DRAW_POINTS = 0,
+  FRAMEBUFFER
+};
 
+RenderMode BgRenderMode = RenderMode::FRAMEBUFFER;
+
+//
+// Current background size, BgPixels and both background textures are
+// recreated in EnsureBgTextures() when it changes.
+//
+uint32_t BgPixelsWidth  = 0;
+uint32_t BgPixelsHeight = 0;
+
+std::vector<uint32_t> BgPixels;
+
+//
+// "--threads N", 0 means one per hardware thread.
+// Used for both background loading and rendering.
+//
+size_t ThreadsCount = 0;
+
+std::unique_ptr<ThreadPool> Workers;
+
+//
+// "--load-report" loads the whole library once on one thread and once on
+// all of them and logs both timings. Loaded images are thrown away, since
+// backgrounds are decoded on demand anyway.
+//
+bool LoadReport = false;
+
+//
+// "--bg-budget N" in MiB. Least recently used backgrounds are evicted when
+// decoded ones take more than that.
+//
+size_t BackgroundsBudget = 16 * 1024 * 1024;
+
+//
+// Animation runs in fixed steps of 1 / TickRate seconds ("--tick-rate N"),
+// however often frames are rendered. If rendering falls behind, at most
+// MaxCatchUpSteps ("--max-catch-up N") steps are made before next frame,
+// the rest of lag is dropped, so animation slows down instead of stalling.
+//
+double TickRate = 60.0;
+
+size_t MaxCatchUpSteps = 5;
+
+//
+// "--fps-limit N", main loop runs at most N times per second, so it doesn't
+// burn the whole core when there is no vsync (e.g. software renderer).
+// 0 means no limit.
+//
+double FrameRateLimit = 60.0;
+
+FrameLimiter Limiter;
+
+//
+// Nothing is rendered while neither backgrounds nor anything on screen
+// can change, and loop just waits for input ("--no-idle" turns it off).
+// Loader thread doesn't post events, so waiting is done in
+// kIdleWaitMs chunks to notice loaded backgrounds.
+//
+bool IdleMode = true;
+
+const int kIdleWaitMs = 100;
+
+//
+// Loop is waiting for input, so FPS counter shows "idle" instead of
+// the last value it had while animating.
+//
+bool Idle = false;
+
+//
+// Real time between two consecutive main loop iterations.
+//
 double DeltaTime = 0.0;
 
 // -----------------------------------------------------------------------------
@@ -103,446 +166,367 @@ size_t CurrentParameterIndex = 0;
 
 // -----------------------------------------------------------------------------
 
-struct BgImage
-{
-  SDL_Surface* OriginalImage = nullptr;
-  SDL_Surface* ImageToDraw   = nullptr;
-
-  SDL_Color Pixels[kBgHeight][kBgWidth]{};
-  uint32_t  PixelsByPaletteIndex[kBgHeight][kBgWidth]{};
-
-  int ScrollSpeedH = 0;
-  int ScrollSpeedV = 0;
-
-  size_t ScrollPosX = 0;
-  size_t ScrollPosY = 0;
-
-  int ScanlineOffsetX = 0;
-  int ScanlineOffsetY = 0;
+BgResidency Backgrounds;
 
-  uint32_t PaletteIndexOffset = 0;
+BgImage* CurrentBackground = nullptr;
 
-  uint32_t PaletteCycleRate = 0;
+OffsetTables BgOffsets;
 
-  double PaletteCycleDeltaTime = 0.0;
+//
+// 'L' puts next background from the list on top of the current one as the
+// second layer, 'B' cycles through the ways they are blended.
+// Second layer has its own scroll / distortion / palette state, but uses
+// the same angle increases.
+//
+bool ShowSecondLayer = false;
 
-  double ScanlineFactorX = 0.0;
-  double ScanlineFactorY = 0.0;
+BlendMode LayersBlendMode = BlendMode::INTERLACE;
 
-  bool PingPongCycling = false;
+BgImage* SecondBackground = nullptr;
 
-  bool PPHitMin = true;
-  bool PPHitMax = false;
+std::vector<BgLayer> Layers(2);
 
-  std::vector<SDL_Color> PaletteColorByIndex;
+// =============================================================================
 
-  std::string Fname;
+//
+// Next one after current, which is among the neighbours that
+// Backgrounds.Request() queues anyway.
+//
+size_t SecondBackgroundIndex()
+{
+  return (CurrentBackgroundIndex + 1) % Backgrounds.Count();
+}
 
-  // ---------------------------------------------------------------------------
+// =============================================================================
 
-  void ResetParams()
+bool EnsureBgTextures(uint32_t width, uint32_t height)
+{
+  if (width == BgPixelsWidth and height == BgPixelsHeight)
   {
-    ScrollSpeedH = 0;
-    ScrollSpeedV = 0;
-
-    ScrollPosX = 0;
-    ScrollPosY = 0;
-
-    ScanlineOffsetX = 0;
-    ScanlineOffsetY = 0;
-
-    PaletteIndexOffset = 0;
-
-    ScanlineFactorX = 0.0;
-    ScanlineFactorY = 0.0;
-
-    AngleIncreaseX = 0.05;
-    AngleIncreaseY = 0.05;
-
-    ScanlineFactorDeltaX = 0.025;
-    ScanlineFactorDeltaY = 0.025;
-
-    PPHitMin = true;
-    PPHitMax = false;
+    return true;
   }
 
-  // ---------------------------------------------------------------------------
-
-  void RandomizeParams()
+  if (BgRenderTexture != nullptr)
   {
-    ScrollSpeedH = ::RandomRange(-5, 5);
-    ScrollSpeedV = ::RandomRange(-5, 5);
-
-    ScrollPosX = 0;
-    ScrollPosY = 0;
-
-    ScanlineOffsetX = 0;
-    ScanlineOffsetY = 0;
-
-    PaletteIndexOffset = 0;
+    SDL_DestroyTexture(BgRenderTexture);
+    BgRenderTexture = nullptr;
+  }
 
-    ScanlineFactorX = ::Random01() * 10.0;
-    ScanlineFactorY = ::Random01() * 10.0;
+  if (BgStreamTexture != nullptr)
+  {
+    SDL_DestroyTexture(BgStreamTexture);
+    BgStreamTexture = nullptr;
+  }
 
-    AngleIncreaseX = ::Random01();
-    AngleIncreaseY = ::Random01();
+  BgPixelsWidth  = 0;
+  BgPixelsHeight = 0;
 
-    ScanlineFactorDeltaX = ::Random01();
-    ScanlineFactorDeltaY = ::Random01();
+  BgRenderTexture = SDL_CreateTexture(Renderer,
+                                      SDL_PIXELFORMAT_RGBA32,
+                                      SDL_TEXTUREACCESS_TARGET,
+                                      width,
+                                      height);
 
-    PPHitMin = true;
-    PPHitMax = false;
+  if (BgRenderTexture == nullptr)
+  {
+    SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                 "Failed to create render texture for background: %s",
+                 SDL_GetError());
+    return false;
   }
 
-  // ---------------------------------------------------------------------------
+  BgStreamTexture = SDL_CreateTexture(Renderer,
+                                      SDL_PIXELFORMAT_RGBA32,
+                                      SDL_TEXTUREACCESS_STREAMING,
+                                      width,
+                                      height);
 
-  std::string GetColorDataString()
+  if (BgStreamTexture == nullptr)
   {
-    std::set<std::string> allColors;
-
-    for (uint16_t y = 0; y < kBgHeight; y++)
-    {
-      for (uint16_t x = 0; x < kBgWidth; x++)
-      {
-        SDL_Color& c = Pixels[y][x];
-
-        std::string key = std::to_string(c.r) +
-                          "/" +
-                          std::to_string(c.g) +
-                          "/" +
-                          std::to_string(c.b);
-        allColors.insert(key);
-      }
-    }
+    SDL_LogError(SDL_LOG_PRIORITY_ERROR,
+                 "Failed to create streaming texture for background: %s",
+                 SDL_GetError());
+    return false;
+  }
 
-    std::stringstream ss;
+  BgPixels.assign((size_t)width * height, 0);
 
-    ss << "\n";
+  BgPixelsWidth  = width;
+  BgPixelsHeight = height;
 
-    size_t ind = 1;
+  return true;
+}
 
-    for (auto& entry : allColors)
-    {
-      ss << ind << " : " << entry << "\n";
-      ind++;
-    }
+// =============================================================================
 
-    return ss.str();
+void RenderBackground()
+{
+  if (CurrentBackground == nullptr)
+  {
+    return;
   }
 
-  // ---------------------------------------------------------------------------
-
-  std::string ToString()
+  if (not EnsureBgTextures(CurrentBackground->Width,
+                           CurrentBackground->Height))
   {
-    std::stringstream ss;
-
-    ss << "------ [PIXELS] ------\n";
-
-    for (uint16_t y = 0; y < kBgHeight; y++)
-    {
-      for (uint16_t x = 0; x < kBgWidth; x++)
-      {
-        ss << "["
-           << (uint16_t)Pixels[y][x].r
-           << ";"
-           << (uint16_t)Pixels[y][x].g
-           << ";"
-           << (uint16_t)Pixels[y][x].b
-           << "]";
-      }
-
-      ss << "\n";
-    }
+    return;
+  }
 
-    ss << "------ [PALETTE] ------\n";
+  if (ShowSecondLayer and SecondBackground != nullptr)
+  {
+    Layers[0].Image = CurrentBackground;
+    Layers[1].Image = SecondBackground;
 
-    for (uint16_t y = 0; y < kBgHeight; y++)
+    for (BgLayer& layer : Layers)
     {
-      for (uint16_t x = 0; x < kBgWidth; x++)
-      {
-        ss << "[" << PixelsByPaletteIndex[y][x] << "]";
-      }
-
-      ss << "\n";
+      layer.PhaseIncX = DegreesToPhase(AngleIncreaseX);
+      layer.PhaseIncY = DegreesToPhase(AngleIncreaseY);
     }
 
-    return ss.str();
+    CompositeLayers(Layers,
+                    LayersBlendMode,
+                    BgPixelsWidth,
+                    BgPixelsHeight,
+                    BgPixels.data(),
+                    *Workers);
   }
-
-  // ---------------------------------------------------------------------------
-
-  void ConstructPaletteMap()
+  else
   {
-    for (uint16_t y = 0; y < kBgHeight; y++)
-    {
-      for (uint16_t x = 0; x < kBgWidth; x++)
-      {
-        const SDL_Color& pixel = Pixels[y][x];
-
-        uint32_t paletteEntry = PaletteColorByIndex.size();
-
-        for (size_t i = 0; i < PaletteColorByIndex.size(); i++)
-        {
-          const SDL_Color& c = PaletteColorByIndex[i];
-
-          if (pixel.r == c.r and pixel.g == c.g and pixel.b == c.b)
-          {
-            paletteEntry = i;
-            break;
-          }
-        }
-
-        PixelsByPaletteIndex[y][x] = paletteEntry;
-      }
-    }
+    RenderParallel(*CurrentBackground,
+                   DegreesToPhase(AngleIncreaseX),
+                   DegreesToPhase(AngleIncreaseY),
+                   BgOffsets,
+                   BgPixels.data(),
+                   *Workers);
   }
 
-  // ---------------------------------------------------------------------------
-
-  void CyclePalette()
+  if (BgRenderMode == RenderMode::FRAMEBUFFER)
   {
-    if (PingPongCycling)
-    {
-      if (PPHitMin and not PPHitMax)
-      {
-        PaletteIndexOffset++;
-      }
-      else if (PPHitMax and not PPHitMin)
-      {
-        PaletteIndexOffset--;
-      }
-
-      if (PaletteIndexOffset == (PaletteColorByIndex.size() - 1))
-      {
-        PPHitMax = true;
-        PPHitMin = false;
-      }
-      else if (PaletteIndexOffset == 0)
-      {
-        PPHitMin = true;
-        PPHitMax = false;
-      }
-
-      //SDL_Log("%u", PaletteIndexOffset);
-    }
-    else
-    {
-      PaletteIndexOffset++;
-      PaletteIndexOffset %= PaletteColorByIndex.size();
-    }
+    SDL_UpdateTexture(BgStreamTexture,
+                      nullptr,
+                      BgPixels.data(),
+                      BgPixelsWidth * sizeof(uint32_t));
   }
-};
-
-std::vector<std::unique_ptr<BgImage>> Backgrounds;
-
-BgImage* CurrentBackground = nullptr;
-
-// =============================================================================
-
-using StringV = std::vector<std::string>;
-
-StringV StringSplit(const std::string& str, char delim)
-{
-  StringV res;
+  else
+  {
+    SDL_SetRenderTarget(Renderer, BgRenderTexture);
+    SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 255);
+    SDL_RenderClear(Renderer);
 
-  int start, end = -1;
+    const uint32_t* pixel = BgPixels.data();
 
-  do
-  {
-    start = end + 1;
-    end = str.find(delim, start);
-    if (end != -1)
+    for (uint32_t y = 0; y < BgPixelsHeight; y++)
     {
-      std::string word = str.substr(start, end - start);
-      res.push_back(word);
-    }
-    else
-    {
-      if (start < (int)str.length())
-      {
-        res.push_back(str.substr(start, str.length()));
-      }
-      else
+      for (uint32_t x = 0; x < BgPixelsWidth; x++)
       {
-        res.push_back("");
+        SDL_Color c = UnpackRGBA32(*pixel++);
+
+        SDL_SetRenderDrawColor(Renderer, c.r, c.g, c.b, 255);
+        SDL_RenderDrawPoint(Renderer, x, y);
       }
     }
   }
-  while (end != -1);
-
-  return res;
 }
 
 // =============================================================================
 
-void ProcessStatic()
+//
+// Framebuffer is split into regions that are redrawn only when they change:
+// background, palette strip and every HUD item (text line or filled rect).
+// Framebuffer keeps its contents between frames, so everything else is left
+// as it is, and the whole thing goes to screen with a single copy.
+// HUD is collected into HudItems by HudPrint() / HudFillRect() and compared
+// with what was drawn last time.
+//
+struct HudItem
 {
-  for (uint16_t y = 0; y < kBgHeight; y++)
-  {
-    size_t iy = y + CurrentBackground->ScrollPosY + (size_t)CurrentBackground->ScanlineOffsetY;
+  std::string Text;
 
-    for (uint16_t x = 0; x < kBgWidth; x++)
-    {
-      CurrentBackground->ScanlineOffsetX = (int)(std::sin(AngleX * PIOVER180) * CurrentBackground->ScanlineFactorX);
-      if (CurrentBackground->ScanlineOffsetX < 0)
-      {
-        CurrentBackground->ScanlineOffsetX += (kBgWidth - 1);
-      }
+  int X = 0;
+  int Y = 0;
 
-      size_t ix = x + CurrentBackground->ScrollPosX + (size_t)CurrentBackground->ScanlineOffsetX;
+  uint32_t Color = 0xFFFFFF;
 
-      ix %= kBgWidth;
-      iy %= kBgHeight;
+  IF::TextAlignment Align = IF::TextAlignment::LEFT;
 
-      SDL_Color& c = CurrentBackground->Pixels[iy][ix];
+  double Scale = 1.0;
 
-      SDL_SetRenderDrawColor(Renderer, c.r, c.g, c.b, 255);
-      SDL_RenderDrawPoint(Renderer, x, y);
+  //
+  // Filled rect of RectColor instead of text.
+  //
+  bool IsRect = false;
 
-      AngleX += AngleIncreaseX;
-      AngleY += AngleIncreaseY;
+  SDL_Color RectColor{};
 
-      if (AngleX > 360.0)
-      {
-        AngleX = 360.0 - AngleX;
-      }
+  SDL_Rect Bounds{};
 
-      if (AngleY > 360.0)
-      {
-        AngleY = 360.0 - AngleY;
-      }
-    }
-
-    CurrentBackground->ScanlineOffsetY = (int)(std::sin(AngleY * PIOVER180) * CurrentBackground->ScanlineFactorY);
-    if (CurrentBackground->ScanlineOffsetY < 0)
-    {
-      CurrentBackground->ScanlineOffsetY += (kBgHeight - 1);
-    }
+  bool operator==(const HudItem& rhs) const
+  {
+    return (Text == rhs.Text
+        and X == rhs.X
+        and Y == rhs.Y
+        and Color == rhs.Color
+        and Align == rhs.Align
+        and Scale == rhs.Scale
+        and IsRect == rhs.IsRect
+        and RectColor.r == rhs.RectColor.r
+        and RectColor.g == rhs.RectColor.g
+        and RectColor.b == rhs.RectColor.b
+        and RectColor.a == rhs.RectColor.a);
   }
-}
 
-// =============================================================================
-
-void ProcessAnimated()
-{
-  for (uint16_t y = 0; y < kBgHeight; y++)
+  bool operator!=(const HudItem& rhs) const
   {
-    size_t iy = y + CurrentBackground->ScrollPosY + (size_t)CurrentBackground->ScanlineOffsetY;
+    return not (*this == rhs);
+  }
+};
 
-    for (uint16_t x = 0; x < kBgWidth; x++)
-    {
-      CurrentBackground->ScanlineOffsetX = (int)(std::sin(AngleX * PIOVER180) * CurrentBackground->ScanlineFactorX);
-      if (CurrentBackground->ScanlineOffsetX < 0)
-      {
-        CurrentBackground->ScanlineOffsetX += (kBgWidth - 1);
-      }
+std::vector<HudItem> HudItems;
 
-      size_t ix = x + CurrentBackground->ScrollPosX + (size_t)CurrentBackground->ScanlineOffsetX;
+//
+// What Framebuffer currently holds.
+//
+struct FramebufferContents
+{
+  bool Valid = false;
 
-      ix %= kBgWidth;
-      iy %= kBgHeight;
+  SDL_Rect BgRect{};
+  SDL_Rect PaletteRect{};
 
-      uint32_t paletteIndex = CurrentBackground->PixelsByPaletteIndex[iy][ix];
+  std::vector<uint32_t> Palette;
+  std::vector<HudItem>  Hud;
+};
 
-      if (paletteIndex == CurrentBackground->PaletteColorByIndex.size())
-      {
-        SDL_Color& c = CurrentBackground->Pixels[iy][ix];
-        SDL_SetRenderDrawColor(Renderer, c.r, c.g, c.b, 255);
-        SDL_RenderDrawPoint(Renderer, x, y);
-      }
-      else
-      {
-        uint32_t poi = CurrentBackground->PaletteIndexOffset;
-        uint32_t newIndex = (paletteIndex + poi);
+FramebufferContents DrawnContents;
 
-        newIndex %= CurrentBackground->PaletteColorByIndex.size();
+//
+// "--full-redraw" clears and redraws the whole Framebuffer every frame.
+//
+bool FullRedraw = false;
 
-        SDL_Color& c = CurrentBackground->PaletteColorByIndex[newIndex];
+//
+// "--redraw-stats" logs once per second how much of Framebuffer was
+// actually redrawn, and how many draw calls that took compared to
+// redrawing everything.
+//
+bool RedrawStats = false;
 
-        SDL_SetRenderDrawColor(Renderer, c.r, c.g, c.b, 255);
-        SDL_RenderDrawPoint(Renderer, x, y);
-      }
+struct RedrawCounters
+{
+  size_t Frames        = 0;
+  size_t Regions       = 0;
+  size_t Pixels        = 0;
+  size_t DrawCalls     = 0;
+  size_t FullDrawCalls = 0;
 
-      AngleX += AngleIncreaseX;
-      AngleY += AngleIncreaseY;
+  Clock::duration ComposeTime{0};
+};
 
-      if (AngleX > 360.0)
-      {
-        AngleX = 360.0 - AngleX;
-      }
+RedrawCounters Redraws;
 
-      if (AngleY > 360.0)
-      {
-        AngleY = 360.0 - AngleY;
-      }
-    }
+// =============================================================================
 
-    CurrentBackground->ScanlineOffsetY = (int)(std::sin(AngleY * PIOVER180) * CurrentBackground->ScanlineFactorY);
-    if (CurrentBackground->ScanlineOffsetY < 0)
-    {
-      CurrentBackground->ScanlineOffsetY += (kBgHeight - 1);
-    }
-  }
+void HudPrint(int x, int y,
+              const std::string& text,
+              uint32_t color = 0xFFFFFF,
+              IF::TextAlignment align = IF::TextAlignment::LEFT,
+              double scaleFactor = 1.0)
+{
+  HudItem item;
+  item.Text   = text;
+  item.X      = x;
+  item.Y      = y;
+  item.Color  = color;
+  item.Align  = align;
+  item.Scale  = scaleFactor;
+  item.Bounds = IF::Instance().TextBounds(x, y, text, align, scaleFactor);
+
+  HudItems.push_back(item);
 }
 
 // =============================================================================
 
-void RenderBackground()
+//
+// C variadic instead of a template so GCC and Clang can check arguments
+// against the format string.
+//
+#if defined(__GNUC__) || defined(__clang__)
+  #define HUD_PRINTF_FORMAT __attribute__((format(printf, 4, 5)))
+#else
+  #define HUD_PRINTF_FORMAT
+#endif
+
+HUD_PRINTF_FORMAT
+void HudPrintf(int x, int y,
+               IF::TextParams params,
+               const char* formatString,
+               ...)
 {
-  if (CurrentBackground == nullptr)
+  va_list args;
+
+  va_start(args, formatString);
+  int size = ::vsnprintf(nullptr, 0, formatString, args);
+  va_end(args);
+
+  if (size <= 0)
   {
     return;
   }
 
-  SDL_SetRenderTarget(Renderer, BgRenderTexture);
-  SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 255);
-  SDL_RenderClear(Renderer);
+  std::string s(size, '\0');
 
-  if (CurrentBackground->PaletteColorByIndex.empty()
-   or CurrentBackground->PaletteCycleRate == 0)
-  {
-    ProcessStatic();
-  }
-  else
-  {
-    ProcessAnimated();
-  }
+  va_start(args, formatString);
+  ::vsnprintf((char*)s.data(), size + 1, formatString, args);
+  va_end(args);
+
+  HudPrint(x, y, s, params.Color, params.Align, params.Scale);
 }
 
 // =============================================================================
 
-void BlitToFramebuffer()
+void HudFillRect(const SDL_Rect& rect, const SDL_Color& color)
 {
-  static SDL_Rect dst;
-  dst.x = kBgDisplayX;
-  dst.y = kBgDisplayY;
-  dst.w = kBgW2;
-  dst.h = kBgH2;
+  HudItem item;
+  item.IsRect    = true;
+  item.RectColor = color;
+  item.Bounds    = rect;
 
-  SDL_SetRenderTarget(Renderer, Framebuffer);
-  SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 255);
-  SDL_RenderClear(Renderer);
-
-  SDL_RenderCopy(Renderer, BgRenderTexture, nullptr, &dst);
+  HudItems.push_back(item);
+}
 
-  static SDL_Rect r;
+// =============================================================================
 
-  for (size_t i = 0; i < CurrentBackground->PaletteColorByIndex.size(); i++)
+//
+// Returns number of draw calls it took.
+//
+size_t DrawHudItem(const HudItem& item)
+{
+  if (item.IsRect)
   {
-    uint32_t paletteIndex = CurrentBackground->PaletteIndexOffset + i;
-
-    paletteIndex %= CurrentBackground->PaletteColorByIndex.size();
-
-    SDL_Color& c = CurrentBackground->PaletteColorByIndex[paletteIndex];
+    //
+    // Text printed so far goes under the rect.
+    //
+    size_t drawCalls = (IF::Instance().Flush() != 0) ? 2 : 1;
+
+    SDL_SetRenderDrawColor(Renderer,
+                           item.RectColor.r,
+                           item.RectColor.g,
+                           item.RectColor.b,
+                           item.RectColor.a);
+    SDL_RenderFillRect(Renderer, &item.Bounds);
+    return drawCalls;
+  }
 
-    r.x = kBgDisplayX + i * 16;
-    r.y = kBgDisplayY + kBgH2 + 16;
-    r.w = 16;
-    r.h = 16;
+  IF::Instance().Print(item.X, item.Y,
+                       item.Text,
+                       item.Color,
+                       item.Align,
+                       item.Scale);
 
-    SDL_SetRenderDrawColor(Renderer, c.r, c.g, c.b, 255);
-    SDL_RenderFillRect(Renderer, &r);
-  }
+  //
+  // Glyphs are drawn later by IF::Flush().
+  //
+  return 0;
 }
 
 // =============================================================================
@@ -554,40 +538,52 @@ void PrintParams()
     return;
   }
 
-  IF::Instance().Printf(0, 0,
-                        IF::TextParams::Set(),
-                        "AngleX = %.2f",
-                        AngleX);
-
-  IF::Instance().Printf(0, 16 * 1,
-                        IF::TextParams::Set(),
-                        "AngleY = %.2f",
-                        AngleY);
-
-  IF::Instance().Printf(0, 16 * 2,
-                        IF::TextParams::Set(),
-                        "ScrollPosX = %lu",
-                        CurrentBackground->ScrollPosX);
-
-  IF::Instance().Printf(0, 16 * 3,
-                        IF::TextParams::Set(),
-                        "ScrollPosY = %lu",
-                        CurrentBackground->ScrollPosY);
-
-  IF::Instance().Printf(0, 16 * 4,
-                        IF::TextParams::Set(),
-                        "ScanlineOffsetX = %d",
-                        CurrentBackground->ScanlineOffsetX);
-
-  IF::Instance().Printf(0, 16 * 5,
-                        IF::TextParams::Set(),
-                        "ScanlineOffsetY = %d",
-                        CurrentBackground->ScanlineOffsetY);
-
-  IF::Instance().Printf(0, 16 * 6,
-                        IF::TextParams::Set(),
-                        "PaletteIndexOffset = %u",
-                        CurrentBackground->PaletteIndexOffset);
+  HudPrintf(0, 0,
+            IF::TextParams::Set(),
+            "AngleX = %.2f",
+            PhaseToDegrees(CurrentBackground->PhaseX));
+
+  HudPrintf(0, 16 * 1,
+            IF::TextParams::Set(),
+            "AngleY = %.2f",
+            PhaseToDegrees(CurrentBackground->PhaseY));
+
+  HudPrintf(0, 16 * 2,
+            IF::TextParams::Set(),
+            "ScrollPosX = %zu",
+            CurrentBackground->ScrollPosX);
+
+  HudPrintf(0, 16 * 3,
+            IF::TextParams::Set(),
+            "ScrollPosY = %zu",
+            CurrentBackground->ScrollPosY);
+
+  HudPrintf(0, 16 * 4,
+            IF::TextParams::Set(),
+            "ScanlineOffsetX = %d",
+            CurrentBackground->ScanlineOffsetX);
+
+  HudPrintf(0, 16 * 5,
+            IF::TextParams::Set(),
+            "ScanlineOffsetY = %d",
+            CurrentBackground->ScanlineOffsetY);
+
+  std::string offsets;
+
+  for (const PaletteCycle& cycle : CurrentBackground->PaletteCycles)
+  {
+    offsets += " " + std::to_string(cycle.Offset);
+  }
+
+  HudPrintf(0, 16 * 6,
+            IF::TextParams::Set(),
+            "PaletteOffsets =%s",
+            offsets.data());
+
+  HudPrintf(0, 16 * 7,
+            IF::TextParams::Set(),
+            "Distortion = %s",
+            DistortionTypeName(CurrentBackground->CurrentDistortion.Type));
 }
 
 // =============================================================================
@@ -598,6 +594,11 @@ const std::string kCursorLine = "-----------------------------";
 
 void PrintModifiableParams()
 {
+  if (CurrentBackground == nullptr)
+  {
+    return;
+  }
+
   Parameters currentParam = (Parameters)CurrentParameterIndex;
 
   switch (currentParam)
@@ -618,50 +619,50 @@ void PrintModifiableParams()
   // ---------------------------------------------------------------------------
   // Cursor
 
-  IF::Instance().Print(0, CursorPositionY + 6, kCursorLine, 0x00FF00);
-  IF::Instance().Print(0, CursorPositionY - 6, kCursorLine, 0x00FF00);
+  HudPrint(0, CursorPositionY + 6, kCursorLine, 0x00FF00);
+  HudPrint(0, CursorPositionY - 6, kCursorLine, 0x00FF00);
 
   // ---------------------------------------------------------------------------
 
-  IF::Instance().Printf(0, 16 * 9,
-                        IF::TextParams::Set(),
-                        "ScrollSpeedH = %d",
-                        CurrentBackground->ScrollSpeedH);
-
-  IF::Instance().Printf(0, 16 * 10,
-                        IF::TextParams::Set(),
-                        "ScrollSpeedV = %d",
-                        CurrentBackground->ScrollSpeedV);
-
-  IF::Instance().Printf(0, 16 * 11,
-                        IF::TextParams::Set(),
-                        "AngleIncreaseX = %.2f",
-                        AngleIncreaseX);
-
-  IF::Instance().Printf(0, 16 * 12,
-                        IF::TextParams::Set(),
-                        "AngleIncreaseY = %.2f",
-                        AngleIncreaseY);
-
-  IF::Instance().Printf(0, 16 * 13,
-                        IF::TextParams::Set(),
-                        "ScanlineFactorDeltaX = %.4f",
-                        ScanlineFactorDeltaX);
-
-  IF::Instance().Printf(0, 16 * 14,
-                        IF::TextParams::Set(),
-                        "ScanlineFactorDeltaY = %.4f",
-                        ScanlineFactorDeltaY);
-
-  IF::Instance().Printf(0, 16 * 15,
-                        IF::TextParams::Set(),
-                        "ScanlineFactorX = %.2f",
-                        CurrentBackground->ScanlineFactorX);
-
-  IF::Instance().Printf(0, 16 * 16,
-                        IF::TextParams::Set(),
-                        "ScanlineFactorY = %.2f",
-                        CurrentBackground->ScanlineFactorY);
+  HudPrintf(0, 16 * 9,
+            IF::TextParams::Set(),
+            "ScrollSpeedH = %d",
+            CurrentBackground->ScrollSpeedH);
+
+  HudPrintf(0, 16 * 10,
+            IF::TextParams::Set(),
+            "ScrollSpeedV = %d",
+            CurrentBackground->ScrollSpeedV);
+
+  HudPrintf(0, 16 * 11,
+            IF::TextParams::Set(),
+            "AngleIncreaseX = %.2f",
+            AngleIncreaseX);
+
+  HudPrintf(0, 16 * 12,
+            IF::TextParams::Set(),
+            "AngleIncreaseY = %.2f",
+            AngleIncreaseY);
+
+  HudPrintf(0, 16 * 13,
+            IF::TextParams::Set(),
+            "ScanlineFactorDeltaX = %.4f",
+            ScanlineFactorDeltaX);
+
+  HudPrintf(0, 16 * 14,
+            IF::TextParams::Set(),
+            "ScanlineFactorDeltaY = %.4f",
+            ScanlineFactorDeltaY);
+
+  HudPrintf(0, 16 * 15,
+            IF::TextParams::Set(),
+            "ScanlineFactorX = %.2f",
+            CurrentBackground->ScanlineFactorX);
+
+  HudPrintf(0, 16 * 16,
+            IF::TextParams::Set(),
+            "ScanlineFactorY = %.2f",
+            CurrentBackground->ScanlineFactorY);
 }
 
 // =============================================================================
@@ -670,75 +671,124 @@ void PrintHelp()
 {
   static SDL_Rect bg;
   bg.x = kScreenWidth - 340;
-  bg.y = kScreenHeight - 144;
+  bg.y = kScreenHeight - 192;
   bg.w = 340;
-  bg.h = 104;
-
-  SDL_SetRenderDrawColor(Renderer, 128, 128, 128, 220);
-  SDL_RenderFillRect(Renderer, &bg);
-
-  IF::Instance().Print(kScreenWidth - 340 + 16, kScreenHeight - 144 + 16,
-                       "UP DOWN    - move cursor",
-                       0xFFFFFF,
-                       IF::TextAlignment::LEFT);
-
-  IF::Instance().Print(kScreenWidth - 340 + 16, kScreenHeight - 144 + 16 * 2,
-                       "LEFT RIGHT - change parameter value",
-                       0xFFFFFF,
-                       IF::TextAlignment::LEFT);
-
-  IF::Instance().Print(kScreenWidth - 340 + 16, kScreenHeight - 144 + 16 * 3,
-                       "[ ]        - change background image",
-                       0xFFFFFF,
-                       IF::TextAlignment::LEFT);
-
-  IF::Instance().Print(kScreenWidth - 340 + 16, kScreenHeight - 144 + 16 * 4,
-                       "'r'        - randomize params",
-                       0xFFFFFF,
-                       IF::TextAlignment::LEFT);
-
-  IF::Instance().Print(kScreenWidth - 340 + 16, kScreenHeight - 144 + 16 * 5,
-                       "'SPACE'    - reset params",
-                       0xFFFFFF,
-                       IF::TextAlignment::LEFT);
+  bg.h = 152;
+
+  HudFillRect(bg, { 128, 128, 128, 220 });
+
+  HudPrint(kScreenWidth - 340 + 16, kScreenHeight - 192 + 16,
+           "UP DOWN    - move cursor",
+           0xFFFFFF,
+           IF::TextAlignment::LEFT);
+
+  HudPrint(kScreenWidth - 340 + 16, kScreenHeight - 192 + 16 * 2,
+           "LEFT RIGHT - change parameter value",
+           0xFFFFFF,
+           IF::TextAlignment::LEFT);
+
+  HudPrint(kScreenWidth - 340 + 16, kScreenHeight - 192 + 16 * 3,
+           "[ ]        - change background image",
+           0xFFFFFF,
+           IF::TextAlignment::LEFT);
+
+  HudPrint(kScreenWidth - 340 + 16, kScreenHeight - 192 + 16 * 4,
+           "'r'        - randomize params",
+           0xFFFFFF,
+           IF::TextAlignment::LEFT);
+
+  HudPrint(kScreenWidth - 340 + 16, kScreenHeight - 192 + 16 * 5,
+           "'SPACE'    - reset params",
+           0xFFFFFF,
+           IF::TextAlignment::LEFT);
+
+  HudPrint(kScreenWidth - 340 + 16, kScreenHeight - 192 + 16 * 6,
+           "'L'        - toggle second layer",
+           0xFFFFFF,
+           IF::TextAlignment::LEFT);
+
+  HudPrint(kScreenWidth - 340 + 16, kScreenHeight - 192 + 16 * 7,
+           "'B'        - change blend mode",
+           0xFFFFFF,
+           IF::TextAlignment::LEFT);
+
+  HudPrint(kScreenWidth - 340 + 16, kScreenHeight - 192 + 16 * 8,
+           "'D'        - change distortion type",
+           0xFFFFFF,
+           IF::TextAlignment::LEFT);
 }
 
 // =============================================================================
 
 void PrintText()
 {
-  if (Backgrounds.empty())
+  if (Backgrounds.Count() == 0)
   {
-    IF::Instance().Print(kScreenWH,
-                         kScreenHH,
-                         "No images!",
-                         0xFFFFFF,
-                         IF::TextAlignment::CENTER,
-                         4.0);
+    HudPrint(kScreenWH,
+             kScreenHH,
+             "No images!",
+             0xFFFFFF,
+             IF::TextAlignment::CENTER,
+             4.0);
     return;
   }
 
+  if (CurrentBackground == nullptr)
+  {
+    bool failed = Backgrounds.IsFailed(CurrentBackgroundIndex);
+
+    HudPrint(kBgDisplayX + kBgDisplayW / 2,
+             kBgDisplayY + kBgDisplayH / 2,
+             failed ? "Failed to load!" : "Loading...",
+             0xFFFFFF,
+             IF::TextAlignment::CENTER,
+             2.0);
+  }
+
   PrintParams();
   PrintModifiableParams();
 
-  IF::Instance().Print(kScreenWidth - 16, kScreenHeight - 16,
-                       "'H' - toggle help",
-                       0xFFFFFF,
-                       IF::TextAlignment::RIGHT);
-
-  IF::Instance().Printf(kScreenWidth - 16, kScreenHeight - 32,
-                        IF::TextParams::Set(0xFFFFFF,
-                                            IF::TextAlignment::RIGHT,
-                                            1.0),
-                        "%u/%u",
-                        (CurrentBackgroundIndex + 1), Backgrounds.size());
-
-  IF::Instance().Printf(8, kScreenHeight - 32,
-                        IF::TextParams::Set(0xFFFFFF,
-                                            IF::TextAlignment::LEFT,
-                                            2.0),
-                        "FPS: %u",
-                        FPS);
+  HudPrint(kScreenWidth - 16, kScreenHeight - 16,
+           "'H' - toggle help",
+           0xFFFFFF,
+           IF::TextAlignment::RIGHT);
+
+  HudPrintf(kScreenWidth - 16, kScreenHeight - 32,
+            IF::TextParams::Set(0xFFFFFF,
+                                IF::TextAlignment::RIGHT,
+                                1.0),
+            "%zu/%zu",
+            (CurrentBackgroundIndex + 1), Backgrounds.Count());
+
+  if (ShowSecondLayer)
+  {
+    HudPrintf(8, kScreenHeight - 64,
+              IF::TextParams::Set(0xFFFFFF,
+                                  IF::TextAlignment::LEFT,
+                                  1.0),
+              "Second layer: %zu/%zu (%s)",
+              (SecondBackgroundIndex() + 1),
+              Backgrounds.Count(),
+              BlendModeName(LayersBlendMode));
+  }
+
+  if (Idle)
+  {
+    HudPrint(8, kScreenHeight - 32,
+             "FPS: idle",
+             0xFFFFFF,
+             IF::TextAlignment::LEFT,
+             2.0);
+  }
+  else
+  {
+    HudPrintf(8, kScreenHeight - 32,
+              IF::TextParams::Set(0xFFFFFF,
+                                  IF::TextAlignment::LEFT,
+                                  2.0),
+              "FPS: %u",
+              FPS);
+  }
 
   if (ShowHelp)
   {
@@ -748,6 +798,288 @@ void PrintText()
 
 // =============================================================================
 
+//
+// Rects that overlap are merged, so that nothing is drawn twice.
+//
+void MergeOverlapping(std::vector<SDL_Rect>& rects)
+{
+  bool merged = true;
+
+  while (merged)
+  {
+    merged = false;
+
+    for (size_t i = 0; i < rects.size() and not merged; i++)
+    {
+      for (size_t j = i + 1; j < rects.size(); j++)
+      {
+        if (SDL_HasIntersection(&rects[i], &rects[j]))
+        {
+          SDL_UnionRect(&rects[i], &rects[j], &rects[i]);
+          rects.erase(rects.begin() + j);
+          merged = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+// =============================================================================
+
+//
+// backgroundChanged tells whether background pixels were rendered again
+// since last time.
+//
+void BlitToFramebuffer(bool backgroundChanged)
+{
+  Clock::time_point tpStart = Clock::now();
+
+  FramebufferContents contents;
+  contents.Valid = true;
+
+  //
+  // Fit into display area keeping aspect ratio, centered.
+  // Nothing was rendered yet if size is 0.
+  //
+  if (BgPixelsWidth != 0 and BgPixelsHeight != 0)
+  {
+    double scale = std::min((double)kBgDisplayW / (double)BgPixelsWidth,
+                            (double)kBgDisplayH / (double)BgPixelsHeight);
+
+    SDL_Rect& dst = contents.BgRect;
+    dst.w = (int)(BgPixelsWidth * scale);
+    dst.h = (int)(BgPixelsHeight * scale);
+    dst.x = kBgDisplayX + (kBgDisplayW - dst.w) / 2;
+    dst.y = kBgDisplayY + (kBgDisplayH - dst.h) / 2;
+  }
+
+  if (CurrentBackground != nullptr)
+  {
+    const size_t paletteSize = CurrentBackground->PaletteColorByIndex.size();
+
+    contents.Palette.assign(CurrentBackground->PaletteLut,
+                            CurrentBackground->PaletteLut + paletteSize);
+
+    contents.PaletteRect.x = kBgDisplayX;
+    contents.PaletteRect.y = kBgDisplayY + kBgDisplayH + 16;
+    contents.PaletteRect.w = 16 * paletteSize;
+    contents.PaletteRect.h = 16;
+  }
+
+  HudItems.clear();
+
+  PrintText();
+
+  contents.Hud.swap(HudItems);
+
+  // ---------------------------------------------------------------------------
+
+  std::vector<SDL_Rect> dirty;
+
+  auto AddDirty = [&dirty](const SDL_Rect& r)
+  {
+    if (r.w > 0 and r.h > 0)
+    {
+      dirty.push_back(r);
+    }
+  };
+
+  const FramebufferContents& drawn = DrawnContents;
+
+  if (FullRedraw or not drawn.Valid)
+  {
+    AddDirty({ 0, 0, kScreenWidth, kScreenHeight });
+  }
+  else
+  {
+    if (not SDL_RectEquals(&contents.BgRect, &drawn.BgRect))
+    {
+      AddDirty(drawn.BgRect);
+      AddDirty(contents.BgRect);
+    }
+    else if (backgroundChanged)
+    {
+      AddDirty(contents.BgRect);
+    }
+
+    if (contents.Palette != drawn.Palette)
+    {
+      AddDirty(drawn.PaletteRect);
+      AddDirty(contents.PaletteRect);
+    }
+
+    size_t itemsCount = std::max(contents.Hud.size(), drawn.Hud.size());
+
+    for (size_t i = 0; i < itemsCount; i++)
+    {
+      bool isNew = (i < contents.Hud.size());
+      bool wasOld = (i < drawn.Hud.size());
+
+      if (isNew and wasOld and contents.Hud[i] == drawn.Hud[i])
+      {
+        continue;
+      }
+
+      if (wasOld)
+      {
+        AddDirty(drawn.Hud[i].Bounds);
+      }
+
+      if (isNew)
+      {
+        AddDirty(contents.Hud[i].Bounds);
+      }
+    }
+  }
+
+  MergeOverlapping(dirty);
+
+  // ---------------------------------------------------------------------------
+
+  SDL_SetRenderTarget(Renderer, Framebuffer);
+
+  SDL_Texture* bgTexture = (BgRenderMode == RenderMode::FRAMEBUFFER)
+                          ? BgStreamTexture
+                          : BgRenderTexture;
+
+  size_t drawCalls = 0;
+  size_t pixels    = 0;
+
+  //
+  // Everything is drawn in the usual order, but only what intersects dirty
+  // region, and clipped by it.
+  //
+  for (const SDL_Rect& region : dirty)
+  {
+    SDL_RenderSetClipRect(Renderer, &region);
+
+    SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(Renderer, &region);
+
+    drawCalls++;
+    pixels += (size_t)region.w * region.h;
+
+    if (contents.BgRect.w != 0
+    and SDL_HasIntersection(&contents.BgRect, &region))
+    {
+      SDL_RenderCopy(Renderer, bgTexture, nullptr, &contents.BgRect);
+      drawCalls++;
+    }
+
+    for (size_t i = 0; i < contents.Palette.size(); i++)
+    {
+      SDL_Rect r;
+      r.x = contents.PaletteRect.x + i * 16;
+      r.y = contents.PaletteRect.y;
+      r.w = 16;
+      r.h = 16;
+
+      if (not SDL_HasIntersection(&r, &region))
+      {
+        continue;
+      }
+
+      SDL_Color c = UnpackRGBA32(contents.Palette[i]);
+
+      SDL_SetRenderDrawColor(Renderer, c.r, c.g, c.b, 255);
+      SDL_RenderFillRect(Renderer, &r);
+
+      drawCalls++;
+    }
+
+    for (const HudItem& item : contents.Hud)
+    {
+      if (item.Bounds.w != 0 and SDL_HasIntersection(&item.Bounds, &region))
+      {
+        drawCalls += DrawHudItem(item);
+      }
+    }
+
+    if (IF::Instance().Flush() != 0)
+    {
+      drawCalls++;
+    }
+  }
+
+  SDL_RenderSetClipRect(Renderer, nullptr);
+
+  // ---------------------------------------------------------------------------
+
+  if (RedrawStats)
+  {
+    size_t fullDrawCalls = 1 + contents.Palette.size();
+
+    if (contents.BgRect.w != 0)
+    {
+      fullDrawCalls++;
+    }
+
+    //
+    // Every rect plus one batch of glyphs before each rect and at the end.
+    //
+    bool hasText = false;
+
+    for (const HudItem& item : contents.Hud)
+    {
+      if (item.IsRect)
+      {
+        fullDrawCalls += hasText ? 2 : 1;
+        hasText = false;
+      }
+      else
+      {
+        hasText = true;
+      }
+    }
+
+    if (hasText)
+    {
+      fullDrawCalls++;
+    }
+
+    Redraws.Frames++;
+    Redraws.Regions       += dirty.size();
+    Redraws.Pixels        += pixels;
+    Redraws.DrawCalls     += drawCalls;
+    Redraws.FullDrawCalls += fullDrawCalls;
+    Redraws.ComposeTime   += Clock::now() - tpStart;
+  }
+
+  DrawnContents = std::move(contents);
+}
+
+// =============================================================================
+
+void LogRedrawStats()
+{
+  if (not RedrawStats or Redraws.Frames == 0)
+  {
+    return;
+  }
+
+  const double frames = (double)Redraws.Frames;
+
+  const double screenPixels = (double)kScreenWidth * kScreenHeight;
+
+  const double composeUs =
+    std::chrono::duration<double, std::micro>(Redraws.ComposeTime).count();
+
+  SDL_Log("Redraw: %zu frames, %.1f regions and %.1f%% of framebuffer "
+          "per frame, %.0f draw calls per frame (%.0f with full redraw), "
+          "%.0f us per frame",
+          Redraws.Frames,
+          Redraws.Regions / frames,
+          Redraws.Pixels / frames / screenPixels * 100.0,
+          Redraws.DrawCalls / frames,
+          Redraws.FullDrawCalls / frames,
+          composeUs / frames);
+
+  Redraws = RedrawCounters();
+}
+
+// =============================================================================
+
 void BlitToScreen()
 {
   SDL_SetRenderTarget(Renderer, nullptr);
@@ -756,17 +1088,23 @@ void BlitToScreen()
 
   SDL_RenderCopy(Renderer, Framebuffer, nullptr, nullptr);
 
-  PrintText();
-
   SDL_RenderPresent(Renderer);
 }
 
 // =============================================================================
 
-void Display()
+//
+// Background is rendered again only if it could have changed,
+// otherwise it's only HUD that gets updated.
+//
+void Display(bool backgroundChanged)
 {
-  RenderBackground();
-  BlitToFramebuffer();
+  if (backgroundChanged)
+  {
+    RenderBackground();
+  }
+
+  BlitToFramebuffer(backgroundChanged);
   BlitToScreen();
 }
 
@@ -851,11 +1189,11 @@ void ProcessCurrentParamDecrease()
 
 void RandomizeParams()
 {
-  AngleIncreaseX = 0.05;
-  AngleIncreaseY = 0.05;
-
-  ScanlineFactorDeltaX = 0.025;
-  ScanlineFactorDeltaY = 0.025;
+  AngleIncreaseX = ::Random01();
+  AngleIncreaseY = ::Random01();
+
+  ScanlineFactorDeltaX = ::Random01();
+  ScanlineFactorDeltaY = ::Random01();
 
   if (CurrentBackground != nullptr)
   {
@@ -881,6 +1219,59 @@ void ResetParams()
 
 // =============================================================================
 
+//
+// Decoding happens on the loader thread, so CurrentBackground stays nullptr
+// until image arrives (see main loop).
+//
+void SelectBackground()
+{
+  Backgrounds.Request(CurrentBackgroundIndex);
+
+  CurrentBackground = Backgrounds.Get(CurrentBackgroundIndex);
+}
+
+// =============================================================================
+
+bool IsAnimating()
+{
+  const uint32_t phaseIncX = DegreesToPhase(AngleIncreaseX);
+  const uint32_t phaseIncY = DegreesToPhase(AngleIncreaseY);
+
+  return ((CurrentBackground != nullptr
+       and IsAnimated(*CurrentBackground, phaseIncX, phaseIncY))
+       or (SecondBackground != nullptr
+       and IsAnimated(*SecondBackground, phaseIncX, phaseIncY)));
+}
+
+// =============================================================================
+
+void Tick(double dt)
+{
+  const uint32_t phaseIncX = DegreesToPhase(AngleIncreaseX);
+  const uint32_t phaseIncY = DegreesToPhase(AngleIncreaseY);
+
+  if (CurrentBackground == nullptr)
+  {
+    return;
+  }
+
+  //
+  // Output is always of current background size (see RenderBackground()),
+  // second layer included.
+  //
+  const uint32_t width  = CurrentBackground->Width;
+  const uint32_t height = CurrentBackground->Height;
+
+  AdvanceBackground(*CurrentBackground, phaseIncX, phaseIncY, width, height, dt);
+
+  if (SecondBackground != nullptr)
+  {
+    AdvanceBackground(*SecondBackground, phaseIncX, phaseIncY, width, height, dt);
+  }
+}
+
+// =============================================================================
+
 void HandleEvent(const SDL_Event& evt)
 {
   switch (evt.type)
@@ -895,32 +1286,30 @@ void HandleEvent(const SDL_Event& evt)
 
         case SDLK_RIGHTBRACKET:
         {
-          CurrentBackgroundIndex++;
-          CurrentBackgroundIndex %= Backgrounds.size();
-
-          if (not Backgrounds.empty())
+          if (Backgrounds.Count() != 0)
           {
-            CurrentBackground = Backgrounds[CurrentBackgroundIndex].get();
+            CurrentBackgroundIndex++;
+            CurrentBackgroundIndex %= Backgrounds.Count();
+
+            SelectBackground();
           }
         }
         break;
 
         case SDLK_LEFTBRACKET:
         {
-          if (not Backgrounds.empty())
+          if (Backgrounds.Count() != 0)
           {
             if (CurrentBackgroundIndex == 0)
             {
-              CurrentBackgroundIndex = Backgrounds.size() - 1;
+              CurrentBackgroundIndex = Backgrounds.Count() - 1;
             }
             else
             {
               CurrentBackgroundIndex--;
             }
 
-            CurrentBackgroundIndex %= Backgrounds.size();
-
-            CurrentBackground = Backgrounds[CurrentBackgroundIndex].get();
+            SelectBackground();
           }
         }
         break;
@@ -963,195 +1352,61 @@ void HandleEvent(const SDL_Event& evt)
           ShowHelp = not ShowHelp;
           break;
 
-        case SDLK_p:
+        case SDLK_l:
         {
-          for (auto& item : Backgrounds)
+          if (Backgrounds.Count() > 1)
           {
-            SDL_Log("\n-------- '%s' --------\n", item->Fname.data());
-            SDL_Log("%s", item->GetColorDataString().data());
-            SDL_Log("\n--------\n");
+            ShowSecondLayer = not ShowSecondLayer;
           }
         }
         break;
-      }
-    }
-  }
-}
-
-// =============================================================================
-
-bool LoadImage(const std::string& fname)
-{
-  using namespace std::filesystem;
-
-  SDL_Surface* s = SDL_LoadBMP(fname.data());
-  if (s == nullptr)
-  {
-    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
-                "'%s' - failed to load image: %s",
-                fname.data(), SDL_GetError());
-    return false;
-  }
-
-  if (s->w != kBgWidth or s->h != kBgHeight)
-  {
-    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
-                "'%s' - wrong image size! All background images must be 24 bit "
-                "BMPs of %ux%u size! Skipping this one.",
-                fname.data(), kBgWidth, kBgHeight);
-    SDL_FreeSurface(s);
-    return false;
-  }
-
-  std::unique_ptr<BgImage> image = std::make_unique<BgImage>();
-
-  image->Fname = fname;
-
-  auto Exit = [&image]()
-  {
-    Backgrounds.push_back(std::move(image));
-    return true;
-  };
-
-  uint8_t* pixels = (uint8_t*)s->pixels;
-
-  uint8_t bpp = s->format->BytesPerPixel;
-
-  uint32_t realWidth  = s->w * bpp;
-  uint32_t realHeight = s->h * bpp;
-
-  uint16_t arrayIndexWidth  = 0;
-  uint16_t arrayIndexHeight = 0;
 
-  for (uint32_t y = 0; y < realHeight; y += bpp)
-  {
-    arrayIndexWidth = 0;
-    for (uint16_t x = 0; x < realWidth; x += bpp)
-    {
-      //
-      // NOTE: assuming little endian.
-      //
-      uint8_t r = pixels[(x + 2 + y * s->w)];
-      uint8_t g = pixels[(x + 1 + y * s->w)];
-      uint8_t b = pixels[(x     + y * s->w)];
-
-      SDL_Color& c = image->Pixels[arrayIndexHeight][arrayIndexWidth];
-      c.r = r;
-      c.g = g;
-      c.b = b;
-
-      arrayIndexWidth++;
-    }
-
-    arrayIndexHeight++;
-  }
-
-  auto spl = StringSplit(fname, '.');
-
-  std::string imgDataFname = spl[0] + ".txt";
-
-  path p{imgDataFname};
-
-  if (not exists(p))
-  {
-    SDL_Log("'%s' - no accompanying data file found.",
-            fname.data());
-    return Exit();
-  }
-
-  if (not is_regular_file(p))
-  {
-    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
-                "'%s' - not a regular file!",
-                p.c_str());
-    return Exit();
-  }
-
-  NRS r;
-
-  NRS::LoadResult lr = r.Load(imgDataFname);
-  if (lr != NRS::LoadResult::LOAD_OK)
-  {
-    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
-                "'%s' - failed to parse image data file: %s",
-                imgDataFname.data(), NRS::LoadResultToString(lr));
-    return Exit();
-  }
-
-  if (not r.Has("palette"))
-  {
-    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
-                "'palette' section was not found - palette information "
-                "will be ignored");
-    return Exit();
-  }
-
-  NRS& pn = r["palette"];
-
-  if (not pn.Has("colors"))
-  {
-    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
-                "No color information was found in 'palette' section!");
-    return Exit();
-  }
-
-  NRS& n = r.GetNode("palette.colors");
-
-  size_t itemsCount = n.ChildrenCount();
-  for (size_t i = 0; i < itemsCount; i++)
-  {
-    // NOTE: operator[] doesn't work sometimes.
-    std::string ind = std::to_string(i + 1);
+        case SDLK_d:
+        {
+          if (CurrentBackground != nullptr)
+          {
+            Distortion& d = CurrentBackground->CurrentDistortion;
 
-    uint8_t r = n.GetNode(ind).GetInt(0);
-    uint8_t g = n.GetNode(ind).GetInt(1);
-    uint8_t b = n.GetNode(ind).GetInt(2);
+            int type = (int)d.Type + 1;
+            type %= (int)DistortionType::LAST_ELEMENT;
 
-    SDL_Color pc;
-    pc.r = r;
-    pc.g = g;
-    pc.b = b;
+            d.Type = (DistortionType)type;
+          }
+        }
+        break;
 
-    image->PaletteColorByIndex.push_back(pc);
-  }
+        case SDLK_b:
+        {
+          int mode = (int)LayersBlendMode + 1;
+          mode %= (int)BlendMode::LAST_ELEMENT;
 
-  if (not image->PaletteColorByIndex.empty())
-  {
-    image->ConstructPaletteMap();
-  }
-  else
-  {
-    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
-                "No data was found in palette section!");
-  }
+          LayersBlendMode = (BlendMode)mode;
+        }
+        break;
 
-  if (not pn.Has("cycleRate"))
-  {
-    SDL_LogWarn(SDL_LOG_PRIORITY_WARN,
-                "'cycleRate' is not present - assuming 0");
-    image->PaletteCycleRate = 0;
-  }
-  else
-  {
-    int64_t cycleRate = r.GetNode("palette.cycleRate").GetInt();
-    image->PaletteCycleRate = (uint32_t)cycleRate;
+        case SDLK_p:
+        {
+          //
+          // Debug dump of the whole library, so just load everything
+          // again right here instead of going through residency.
+          //
+          for (size_t i = 0; i < Backgrounds.Count(); i++)
+          {
+            std::unique_ptr<BgImage> item = LoadImage(Backgrounds.Fname(i));
+            if (item == nullptr)
+            {
+              continue;
+            }
 
-    if (cycleRate != 0)
-    {
-      image->PaletteCycleDeltaTime = 1.0 / (double)cycleRate;
+            SDL_Log("\n-------- '%s' --------\n", item->Fname.data());
+            SDL_Log("%s", item->GetColorDataString().data());
+            SDL_Log("\n--------\n");
+          }
+        }
+        break;
+      }
     }
   }
-
-  if (pn.Has("pingPong"))
-  {
-    image->PingPongCycling = r.GetNode("palette.pingPong").GetInt();
-  }
-
-  //SDL_Log("%s", image->ToString().data());
-
-  Backgrounds.push_back(std::move(image));
-
-  return true;
 }
 
 // =============================================================================
@@ -1187,6 +1442,8 @@ void LoadBackgrounds()
     files.insert(item.path().string());
   }
 
+  std::vector<std::string> images;
+
   for (const std::string& fname : files)
   {
     auto spl = StringSplit(fname, '.');
@@ -1203,15 +1460,44 @@ void LoadBackgrounds()
 
     if (extension == "bmp")
     {
-      LoadImage(fname);
+      images.push_back(fname);
     }
   }
 
+  if (LoadReport)
+  {
+    using ms = std::chrono::duration<double, std::milli>;
+
+    ThreadPool serial(1);
+
+    Clock::time_point t0 = Clock::now();
+
+    size_t loaded = LoadImages(images, serial).size();
+
+    ms serialTime = Clock::now() - t0;
+
+    t0 = Clock::now();
+
+    LoadImages(images, *Workers);
+
+    ms parallelTime = Clock::now() - t0;
+
+    SDL_Log("Serial load: %zu backgrounds in %.2f ms",
+            loaded, serialTime.count());
+    SDL_Log("Parallel load: %zu backgrounds in %.2f ms (%zu threads)",
+            loaded, parallelTime.count(), Workers->ThreadsCount());
+  }
+
+  Backgrounds.Init(images, BackgroundsBudget);
+
+  SDL_Log("Found %zu backgrounds (budget %zu KiB)",
+          Backgrounds.Count(), BackgroundsBudget / 1024);
+
   CurrentBackgroundIndex = 0;
 
-  if (not Backgrounds.empty())
+  if (Backgrounds.Count() != 0)
   {
-    CurrentBackground = Backgrounds[CurrentBackgroundIndex].get();
+    SelectBackground();
   }
 }
 
@@ -1221,6 +1507,124 @@ int main(int argc, char* argv[])
 {
   RNG.seed(Clock::now().time_since_epoch().count());
 
+  bool headless = false;
+
+  HeadlessParams headlessParams;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+
+    if (arg == "--draw-points")
+    {
+      BgRenderMode = RenderMode::DRAW_POINTS;
+    }
+    else if (arg == "--framebuffer")
+    {
+      BgRenderMode = RenderMode::FRAMEBUFFER;
+    }
+    else if (arg == "--threads" and i + 1 < argc)
+    {
+      ThreadsCount = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if (arg == "--load-report")
+    {
+      LoadReport = true;
+    }
+    else if (arg == "--bg-budget" and i + 1 < argc)
+    {
+      BackgroundsBudget = std::strtoul(argv[++i], nullptr, 10) * 1024 * 1024;
+    }
+    else if (arg == "--tick-rate" and i + 1 < argc)
+    {
+      TickRate = std::max(std::strtod(argv[++i], nullptr), 1.0);
+    }
+    else if (arg == "--max-catch-up" and i + 1 < argc)
+    {
+      MaxCatchUpSteps = std::max(std::strtoul(argv[++i], nullptr, 10), 1ul);
+    }
+    else if (arg == "--fps-limit" and i + 1 < argc)
+    {
+      FrameRateLimit = std::max(std::strtod(argv[++i], nullptr), 0.0);
+    }
+    else if (arg == "--no-idle")
+    {
+      IdleMode = false;
+    }
+    else if (arg == "--full-redraw")
+    {
+      FullRedraw = true;
+    }
+    else if (arg == "--redraw-stats")
+    {
+      RedrawStats = true;
+    }
+    else if (arg == "--headless")
+    {
+      headless = true;
+    }
+    else if (arg == "--bg" and i + 1 < argc)
+    {
+      headlessParams.BgFname = argv[++i];
+    }
+    else if (arg == "--params" and i + 1 < argc)
+    {
+      headlessParams.ParamsFname = argv[++i];
+    }
+    else if (arg == "--seed" and i + 1 < argc)
+    {
+      headlessParams.UseSeed = true;
+      headlessParams.Seed = std::strtoull(argv[++i], nullptr, 10);
+    }
+    else if (arg == "--frames" and i + 1 < argc)
+    {
+      headlessParams.FramesCount = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if (arg == "--frame-rate" and i + 1 < argc)
+    {
+      headlessParams.FrameRate = std::strtod(argv[++i], nullptr);
+    }
+    else if (arg == "--out" and i + 1 < argc)
+    {
+      headlessParams.OutputDir = argv[++i];
+    }
+    else if (arg == "--format" and i + 1 < argc)
+    {
+      std::string format = argv[++i];
+
+      if (format == "raw")
+      {
+        headlessParams.Format = HeadlessFormat::RAW;
+      }
+      else if (format == "bmp")
+      {
+        headlessParams.Format = HeadlessFormat::BMP;
+      }
+      else if (format == "none")
+      {
+        headlessParams.Format = HeadlessFormat::NONE;
+      }
+      else
+      {
+        printf("Unknown format '%s' - using raw\n", format.data());
+      }
+    }
+    else
+    {
+      printf("Unknown argument '%s' - ignoring\n", arg.data());
+    }
+  }
+
+  //
+  // No window, no renderer, SDL_Init() isn't needed either.
+  //
+  if (headless)
+  {
+    headlessParams.ThreadsCount = ThreadsCount;
+
+    return RunHeadless(headlessParams);
+  }
+
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
   {
     printf("SDL_Init Error: %s\n", SDL_GetError());
@@ -1265,19 +1669,9 @@ int main(int argc, char* argv[])
 
   IF::Instance().Init(Renderer);
 
-  BgRenderTexture = SDL_CreateTexture(Renderer,
-                                      SDL_PIXELFORMAT_RGBA32,
-                                      SDL_TEXTUREACCESS_TARGET,
-                                      kBgWidth,
-                                      kBgHeight);
-
-  if (BgRenderTexture == nullptr)
-  {
-    SDL_LogError(SDL_LOG_PRIORITY_ERROR,
-                 "Failed to create render texture for background: %s",
-                 SDL_GetError());
-    return 1;
-  }
+  SDL_Log("Background render mode: %s",
+          (BgRenderMode == RenderMode::FRAMEBUFFER) ? "framebuffer"
+                                                    : "draw points");
 
   Framebuffer = SDL_CreateTexture(Renderer,
                                   SDL_PIXELFORMAT_RGBA32,
@@ -1294,63 +1688,123 @@ int main(int argc, char* argv[])
     return 1;
   }
 
+  Workers = std::make_unique<ThreadPool>(ThreadsCount);
+
   LoadBackgrounds();
 
   SDL_Event evt;
 
-  Clock::time_point tpStart;
-  Clock::time_point tpEnd;
+  const double tickTime = 1.0 / TickRate;
 
-  ns dt = ns{0};
+  Clock::time_point tpLast = Clock::now();
 
-  double dtAcc     = 0.0;
-  double cycleAcc  = 0.0;
+  double tickAcc = 0.0;
+  double fpsAcc  = 0.0;
 
   uint32_t fpsCount = 0;
 
+  //
+  // What was on screen last time, to redraw once it changes.
+  //
+  const BgImage* drawnBackground       = nullptr;
+  const BgImage* drawnSecondBackground = nullptr;
+
+  Limiter.SetRate(FrameRateLimit);
+
   while (IsRunning)
   {
-    tpStart = Clock::now();
-    tpEnd   = tpStart;
+    bool gotInput = false;
 
     while (SDL_PollEvent(&evt))
     {
       HandleEvent(evt);
+      gotInput = true;
+    }
+
+    std::vector<size_t> pinned = { CurrentBackgroundIndex };
+
+    if (ShowSecondLayer)
+    {
+      pinned.push_back(SecondBackgroundIndex());
     }
 
-    Display();
+    Backgrounds.Update(pinned);
 
-    fpsCount++;
+    CurrentBackground = Backgrounds.Get(CurrentBackgroundIndex);
 
-    tpEnd = Clock::now();
-    dt = tpEnd - tpStart;
+    SecondBackground = ShowSecondLayer
+                     ? Backgrounds.Get(SecondBackgroundIndex())
+                     : nullptr;
 
-    DeltaTime = std::chrono::duration<double>(dt).count();
+    Clock::time_point tpNow = Clock::now();
 
-    dtAcc    += DeltaTime;
-    cycleAcc += DeltaTime;
+    DeltaTime = std::chrono::duration<double>(tpNow - tpLast).count();
 
-    if (dtAcc > 1.0)
+    tpLast = tpNow;
+
+    tickAcc += DeltaTime;
+
+    size_t steps = 0;
+
+    while (tickAcc >= tickTime and steps < MaxCatchUpSteps)
     {
-      FPS = fpsCount;
-      fpsCount = 0;
-      dtAcc = 0.0;
+      Tick(tickTime);
+
+      tickAcc -= tickTime;
+      steps++;
+    }
+
+    if (tickAcc >= tickTime)
+    {
+      tickAcc = 0.0;
     }
 
-    if (CurrentBackground != nullptr)
+    bool animating = IsAnimating();
+
+    bool changed = (gotInput
+                 or CurrentBackground != drawnBackground
+                 or SecondBackground  != drawnSecondBackground);
+
+    //
+    // Nothing has changed since last frame otherwise.
+    // Scroll and palette are whole steps, so there is nothing to interpolate
+    // in between.
+    //
+    if (changed or (steps != 0 and (animating or not IdleMode)))
     {
-      CurrentBackground->ScrollPosX += CurrentBackground->ScrollSpeedH;
-      CurrentBackground->ScrollPosY += CurrentBackground->ScrollSpeedV;
+      Idle = false;
 
-      CurrentBackground->ScrollPosX %= kBgWidth;
-      CurrentBackground->ScrollPosY %= kBgHeight;
+      Display(changed or animating);
+      fpsCount++;
 
-      if (CurrentBackground->PaletteCycleRate > 0
-      and cycleAcc > CurrentBackground->PaletteCycleDeltaTime)
+      drawnBackground       = CurrentBackground;
+      drawnSecondBackground = SecondBackground;
+    }
+    else if (IdleMode and not animating)
+    {
+      //
+      // Only FPS line changes, so only that is redrawn.
+      //
+      if (not Idle)
       {
-        cycleAcc = 0.0;
-        CurrentBackground->CyclePalette();
+        Idle = true;
+        Display(false);
       }
+
+      SDL_WaitEventTimeout(nullptr, kIdleWaitMs);
+    }
+
+    Limiter.Wait();
+
+    fpsAcc += DeltaTime;
+
+    if (fpsAcc > 1.0)
+    {
+      FPS = fpsCount;
+      fpsCount = 0;
+      fpsAcc = 0.0;
+
+      LogRedrawStats();
     }
   }
 
@@ -0,0 +1,236 @@
+#include "mapped-file.h"
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #define NOMINMAX
+  #include <windows.h>
+#else
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace
+{
+  const size_t kInitialBufferSize = 64 * 1024;
+
+  //
+  // Reads everything until EOF. If size is known, buffer gets one extra byte
+  // so that regular file is read in one go, and the next read just confirms
+  // EOF instead of growing the buffer.
+  //
+  template <typename ReadFn>
+  bool ReadAll(size_t sizeHint, std::string& buffer, ReadFn read)
+  {
+    buffer.resize((sizeHint != 0) ? sizeHint + 1 : kInitialBufferSize);
+
+    size_t used = 0;
+
+    while (true)
+    {
+      if (used == buffer.size())
+      {
+        buffer.resize(buffer.size() * 2);
+      }
+
+      long long n = read(&buffer[used], buffer.size() - used);
+      if (n < 0)
+      {
+        buffer.clear();
+        return false;
+      }
+
+      if (n == 0)
+      {
+        break;
+      }
+
+      used += (size_t)n;
+    }
+
+    buffer.resize(used);
+
+    return true;
+  }
+}
+
+// =============================================================================
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& fname)
+{
+  HANDLE file = CreateFileA(fname.data(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            nullptr,
+                            OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return;
+  }
+
+  LARGE_INTEGER size{};
+
+  bool regular = (GetFileType(file) == FILE_TYPE_DISK
+              and GetFileSizeEx(file, &size));
+
+  if (regular and size.QuadPart > 0)
+  {
+    HANDLE mapping = CreateFileMappingA(file,
+                                        nullptr,
+                                        PAGE_READONLY,
+                                        0, 0,
+                                        nullptr);
+    if (mapping != nullptr)
+    {
+      void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if (view != nullptr)
+      {
+        _mapped     = (const char*)view;
+        _mappedSize = (size_t)size.QuadPart;
+        _mapping    = mapping;
+        _isOpen     = true;
+
+        CloseHandle(file);
+        return;
+      }
+
+      CloseHandle(mapping);
+    }
+  }
+
+  _isOpen = ReadAll(regular ? (size_t)size.QuadPart : 0,
+                    _buffer,
+                    [file](char* dst, size_t count) -> long long
+                    {
+                      DWORD toRead = (count > 0x40000000)
+                                   ? 0x40000000
+                                   : (DWORD)count;
+                      DWORD read = 0;
+
+                      if (not ReadFile(file, dst, toRead, &read, nullptr))
+                      {
+                        //
+                        // Pipe closed from the other end is EOF for us.
+                        //
+                        return (GetLastError() == ERROR_BROKEN_PIPE) ? 0 : -1;
+                      }
+
+                      return read;
+                    });
+
+  CloseHandle(file);
+}
+
+// =============================================================================
+
+void MappedFile::Unmap()
+{
+  if (_mapped != nullptr)
+  {
+    UnmapViewOfFile(_mapped);
+    CloseHandle(_mapping);
+
+    _mapped  = nullptr;
+    _mapping = nullptr;
+  }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& fname)
+{
+  int fd = open(fname.data(), O_RDONLY);
+  if (fd < 0)
+  {
+    return;
+  }
+
+  struct stat st{};
+
+  bool regular = (fstat(fd, &st) == 0 and S_ISREG(st.st_mode));
+
+  if (regular and st.st_size > 0)
+  {
+    void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view != MAP_FAILED)
+    {
+      //
+      // Parser goes through it front to back once.
+      //
+      madvise(view, st.st_size, MADV_SEQUENTIAL);
+
+      _mapped     = (const char*)view;
+      _mappedSize = (size_t)st.st_size;
+      _isOpen     = true;
+
+      close(fd);
+      return;
+    }
+  }
+
+  _isOpen = ReadAll(regular ? (size_t)st.st_size : 0,
+                    _buffer,
+                    [fd](char* dst, size_t count) -> long long
+                    {
+                      while (true)
+                      {
+                        ssize_t n = read(fd, dst, count);
+                        if (n >= 0 or errno != EINTR)
+                        {
+                          return n;
+                        }
+                      }
+                    });
+
+  close(fd);
+}
+
+// =============================================================================
+
+void MappedFile::Unmap()
+{
+  if (_mapped != nullptr)
+  {
+    munmap((void*)_mapped, _mappedSize);
+
+    _mapped = nullptr;
+  }
+}
+
+#endif
+
+// =============================================================================
+
+MappedFile::~MappedFile()
+{
+  Unmap();
+}
+
+// =============================================================================
+
+bool MappedFile::IsOpen() const
+{
+  return _isOpen;
+}
+
+// =============================================================================
+
+bool MappedFile::IsMapped() const
+{
+  return (_mapped != nullptr);
+}
+
+// =============================================================================
+
+std::string_view MappedFile::Data() const
+{
+  return IsMapped()
+         ? std::string_view(_mapped, _mappedSize)
+         : std::string_view(_buffer);
+}
@@ -0,0 +1,54 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <string_view>
+
+//
+// Read only view of the whole file contents.
+//
+// Regular files are memory mapped, so nothing is copied and pages are read
+// in by the OS as they're touched. Whatever can't be mapped (pipes, special
+// files, filesystems without mmap support) is read into a buffer instead,
+// with a single read when size is known.
+//
+// Data() is valid for as long as the object lives.
+//
+class MappedFile
+{
+  public:
+    explicit MappedFile(const std::string& fname);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool IsOpen() const;
+
+    //
+    // True if Data() points to mapped memory and not the buffer.
+    //
+    bool IsMapped() const;
+
+    std::string_view Data() const;
+
+  private:
+    void Unmap();
+
+    bool _isOpen = false;
+
+    const char* _mapped = nullptr;
+
+    size_t _mappedSize = 0;
+
+    //
+    // Fallback for files that can't be mapped.
+    //
+    std::string _buffer;
+
+#ifdef _WIN32
+    void* _mapping = nullptr;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -1,225 +1,778 @@
 #include "nrs.h"
+#include "mapped-file.h"
 
-void NRS::SetString(const std::string& s, size_t index)
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <utility>
+
+namespace
 {
-  if (_content.size() <= index)
+  enum CharClass : uint8_t
+  {
+    //
+    // Anything not allowed outside of quotes.
+    //
+    CHAR_INVALID = 0,
+
+    CHAR_VALID,
+    CHAR_WHITESPACE,
+    CHAR_SPECIAL
+  };
+
+  struct CharClassTable
+  {
+    CharClassTable()
+    {
+      for (int c = 33; c < 127; c++)
+      {
+        Classes[c] = CHAR_VALID;
+      }
+
+      for (char c : std::string_view(" \t\n\r\f\v"))
+      {
+        Classes[(uint8_t)c] = CHAR_WHITESPACE;
+      }
+
+      for (char c : std::string_view(":{},\"/"))
+      {
+        Classes[(uint8_t)c] = CHAR_SPECIAL;
+      }
+    }
+
+    uint8_t Classes[256] = { CHAR_INVALID };
+  };
+
+  const CharClassTable kCharClasses;
+
+  inline uint8_t ClassOf(char c)
+  {
+    return kCharClasses.Classes[(uint8_t)c];
+  }
+
+  //
+  // from_chars() doesn't take leading '+', stoll() did.
+  //
+  std::string_view SkipPlus(std::string_view s)
+  {
+    if (s.size() > 1 && s[0] == '+' && s[1] != '-')
+    {
+      s.remove_prefix(1);
+    }
+
+    return s;
+  }
+
+  template <typename T>
+  bool ParseInteger(std::string_view s, T& value)
   {
-    _content.resize(index + 1);
+    s = SkipPlus(s);
+
+    const char* end = s.data() + s.size();
+
+    auto [ptr, ec] = std::from_chars(s.data(), end, value);
+
+    return (ec == std::errc() && ptr == end);
   }
 
-  _content[index] = s;
+  bool ParseDouble(std::string_view s, double& value)
+  {
+    s = SkipPlus(s);
+
+    if (s.empty())
+    {
+      return false;
+    }
+
+#ifdef __cpp_lib_to_chars
+    const char* end = s.data() + s.size();
+
+    auto [ptr, ec] = std::from_chars(s.data(), end, value);
+
+    return (ec == std::errc() && ptr == end);
+#else
+    //
+    // No floating point from_chars() in this standard library,
+    // strtod() needs null terminated string.
+    //
+    char buf[64];
+
+    if (s.size() >= sizeof(buf))
+    {
+      return false;
+    }
+
+    std::memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
+
+    char* end = nullptr;
+
+    value = std::strtod(buf, &end);
+
+    return (end == buf + s.size());
+#endif
+  }
+}
+
+NRS::NRS(Document* document, std::string_view name)
+  : _document(document),
+    _name(name)
+{
 }
 
 // =============================================================================
 
-const std::string& NRS::GetString(size_t index) const
+Arena& NRS::Storage()
 {
-  if (index >= _content.size())
+  if (_document == nullptr)
   {
-    return kEmptyString;
+    _ownDocument = std::make_unique<Document>();
+    _document = _ownDocument.get();
+    _document->Generation = NextGeneration();
   }
 
-  return _content[index];
+  return _document->Storage;
+}
+
+// =============================================================================
+
+void NRS::SetString(std::string_view s, size_t index)
+{
+  std::string_view stored = Storage().Store(s);
+
+  if (index >= _valuesCount)
+  {
+    if (index >= _valuesCapacity)
+    {
+      GrowValues(std::max(index + 1, (size_t)_valuesCapacity * 2));
+    }
+
+    //
+    // Values before index that didn't exist become empty.
+    //
+    std::fill(_values + _valuesCount, _values + index, std::string_view());
+
+    _valuesCount = index + 1;
+  }
+
+  _values[index] = stored;
+
+  if (_numbers != nullptr)
+  {
+    _numbers[index].Type = NumberType::NONE;
+  }
+}
+
+// =============================================================================
+
+std::string_view NRS::GetString(size_t index) const
+{
+  if (index >= _valuesCount)
+  {
+    return std::string_view();
+  }
+
+  return _values[index];
+}
+
+// =============================================================================
+
+template <typename T>
+std::optional<T> NRS::GetNumber(size_t index,
+                                NumberType type,
+                                bool (*parse)(std::string_view, T&)) const
+{
+  if (index >= _valuesCount)
+  {
+    return std::nullopt;
+  }
+
+  CachedNumber* cached = nullptr;
+
+  if (_document->CacheNumbers)
+  {
+    if (_numbers == nullptr)
+    {
+      _numbers = _document->Storage.AllocateArray<CachedNumber>(_valuesCapacity);
+
+      std::fill(_numbers,
+                _numbers + _valuesCapacity,
+                CachedNumber{ NumberType::NONE, 0 });
+    }
+
+    cached = &_numbers[index];
+
+    if (cached->Type == type)
+    {
+      T value;
+      std::memcpy(&value, &cached->Bits, sizeof(T));
+      return value;
+    }
+  }
+
+  T value;
+
+  if (!parse(_values[index], value))
+  {
+    return std::nullopt;
+  }
+
+  if (cached != nullptr)
+  {
+    cached->Type = type;
+    std::memcpy(&cached->Bits, &value, sizeof(T));
+  }
+
+  return value;
+}
+
+// =============================================================================
+
+std::optional<int64_t> NRS::TryGetInt(size_t index) const
+{
+  return GetNumber<int64_t>(index, NumberType::INT, ParseInteger<int64_t>);
+}
+
+// =============================================================================
+
+std::optional<uint64_t> NRS::TryGetUInt(size_t index) const
+{
+  return GetNumber<uint64_t>(index, NumberType::UINT, ParseInteger<uint64_t>);
+}
+
+// =============================================================================
+
+std::optional<double> NRS::TryGetDouble(size_t index) const
+{
+  return GetNumber<double>(index, NumberType::DOUBLE, ParseDouble);
+}
+
+// =============================================================================
+
+std::optional<bool> NRS::TryGetBool(size_t index) const
+{
+  std::string_view s = GetString(index);
+
+  if (s == "true")
+  {
+    return true;
+  }
+
+  if (s == "false")
+  {
+    return false;
+  }
+
+  std::optional<int64_t> value = TryGetInt(index);
+  if (!value.has_value())
+  {
+    return std::nullopt;
+  }
+
+  return (*value != 0);
+}
+
+// =============================================================================
+
+std::optional<NRS::RGB> NRS::TryGetRGB(size_t index) const
+{
+  std::optional<uint64_t> r = TryGetUInt(index);
+  std::optional<uint64_t> g = TryGetUInt(index + 1);
+  std::optional<uint64_t> b = TryGetUInt(index + 2);
+
+  if (!r || !g || !b || *r > 255 || *g > 255 || *b > 255)
+  {
+    return std::nullopt;
+  }
+
+  RGB rgb;
+  rgb.R = (uint8_t)*r;
+  rgb.G = (uint8_t)*g;
+  rgb.B = (uint8_t)*b;
+
+  return rgb;
+}
+
+// =============================================================================
+
+void NRS::CacheNumbers(bool enable)
+{
+  Storage();
+
+  _document->CacheNumbers = enable;
 }
 
 // =============================================================================
 
 void NRS::SetInt(int64_t value, size_t index)
 {
-  SetString(std::to_string(value), index);
+  char buf[32];
+
+  auto res = std::to_chars(buf, buf + sizeof(buf), value);
+
+  SetString(std::string_view(buf, res.ptr - buf), index);
 }
 
 // =============================================================================
 
 int64_t NRS::GetInt(size_t index) const
 {
-  return std::stoll(GetString(index).data());
+  return TryGetInt(index).value_or(0);
 }
 
 // =============================================================================
 
 void NRS::SetUInt(uint64_t value, size_t index)
 {
-  SetString(std::to_string(value), index);
+  char buf[32];
+
+  auto res = std::to_chars(buf, buf + sizeof(buf), value);
+
+  SetString(std::string_view(buf, res.ptr - buf), index);
 }
 
 // =============================================================================
 
 uint64_t NRS::GetUInt(size_t index) const
 {
-  return std::stoull(GetString(index).data());
+  return TryGetUInt(index).value_or(0);
 }
 
 // =============================================================================
 
 void NRS::Clear()
 {
-  _content.clear();
-  _children.clear();
-  _childIndexByName.clear();
-  _currentIndent = 0;
-  _parsingScopeCount = 0;
-  _parsingState = ParsingState::UNDEFINED;
+  _values         = nullptr;
+  _valuesCount    = 0;
+  _valuesCapacity = 0;
+
+  _firstChild    = nullptr;
+  _lastChild     = nullptr;
+  _childrenCount = 0;
+
+  _index         = nullptr;
+  _indexCapacity = 0;
+
+  _numbers = nullptr;
+
+  if (_document != nullptr)
+  {
+    _document->Generation = NextGeneration();
+  }
+
+  //
+  // Only root frees memory, children just forget what they had.
+  //
+  if (_ownDocument != nullptr)
+  {
+    _ownDocument->Source.reset();
+    _ownDocument->Storage.Clear();
+  }
 }
 
 // =============================================================================
 
 size_t NRS::ValuesCount() const
 {
-  return _content.size();
+  return _valuesCount;
 }
 
 // =============================================================================
 
 size_t NRS::ChildrenCount() const
 {
-  return _children.size();
+  return _childrenCount;
 }
 
 // =============================================================================
 
-bool NRS::Has(const std::string& nodeName)
+bool NRS::Has(std::string_view nodeName) const
 {
-  return (_childIndexByName.count(nodeName) == 1);
+  return (FindChild(nodeName) != nullptr);
 }
 
 // =============================================================================
 
-NRS& NRS::operator[](const std::string& nodeName)
+NRS& NRS::operator[](std::string_view nodeName)
 {
-  if (_childIndexByName.count(nodeName) == 0)
+  NRS* child = FindChild(nodeName);
+  if (child != nullptr)
   {
-    _childIndexByName[nodeName] = _children.size();
-
-    _children.push_back({ nodeName, NRS() });
+    return *child;
   }
 
-  return _children[_childIndexByName[nodeName]].second;
+  return AddChild(Storage().Store(nodeName));
 }
 
 // =============================================================================
 
-NRS& NRS::GetNode(const std::string& path)
+NRS& NRS::GetNode(std::string_view path)
 {
-  size_t pos = path.find_first_of('.');
-  if (pos != std::string::npos)
-  {
-    std::string nodeName = path.substr(0, pos);
-    return (*this)[nodeName].GetNode(path.substr(pos + 1, path.length()));
-  }
-  else
+  NRS* node = this;
+
+  while (true)
   {
-    return (*this)[path];
+    size_t pos = path.find('.');
+    if (pos == std::string_view::npos)
+    {
+      return (*node)[path];
+    }
+
+    node = &(*node)[path.substr(0, pos)];
+    path.remove_prefix(pos + 1);
   }
 }
 
 // =============================================================================
 
-const char* NRS::LoadResultToString(LoadResult res)
+NRS::Path::Path(std::string_view path)
 {
-  switch (res)
+  while (true)
   {
-    case LoadResult::LOAD_OK:
-      return "LOAD_OK";
-      break;
+    size_t pos = path.find('.');
 
-    case LoadResult::ERROR:
-      return "ERROR";
-      break;
+    std::string_view name = path.substr(0, pos);
 
-    case LoadResult::INVALID_FORMAT:
-      return "INVALID_FORMAT";
-      break;
+    _segments.push_back({ std::string(name), std::hash<std::string_view>()(name) });
 
-    default:
-      return "UNEXPECTED_CODE";
+    if (pos == std::string_view::npos)
+    {
       break;
+    }
+
+    path.remove_prefix(pos + 1);
   }
 }
 
 // =============================================================================
 
-NRS::LoadResult NRS::Load(const std::string& fname)
+const NRS* NRS::Find(std::string_view path) const
 {
-  LoadResult res = LoadResult::LOAD_OK;
+  const NRS* node = this;
 
-  std::string loaded;
+  while (node != nullptr)
+  {
+    size_t pos = path.find('.');
+    if (pos == std::string_view::npos)
+    {
+      return node->FindChild(path);
+    }
 
-  std::stringstream ss;
+    node = node->FindChild(path.substr(0, pos));
+    path.remove_prefix(pos + 1);
+  }
+
+  return nullptr;
+}
+
+// =============================================================================
+
+NRS* NRS::Find(std::string_view path)
+{
+  return const_cast<NRS*>(std::as_const(*this).Find(path));
+}
+
+// =============================================================================
+
+const NRS* NRS::Find(const Path& path) const
+{
+  if (_document == nullptr)
+  {
+    return nullptr;
+  }
+
+  if (path._from == this
+   && path._generation == _document->Generation
+   && path._found != nullptr)
+  {
+    return path._found;
+  }
+
+  const NRS* node = this;
+
+  for (const Path::Segment& s : path._segments)
+  {
+    node = node->FindChild(s.Name, s.Hash);
+    if (node == nullptr)
+    {
+      return nullptr;
+    }
+  }
 
   //
-  // If we're going to use encryption, we cannot use std::getline for reading
-  // back, because it reads until it meets a delimiter, which can suddenly
-  // appear in encrypted file and thus fuck up our reading.
+  // Only hits are remembered: nodes can be added after a miss,
+  // but found one stays where it is until Clear().
   //
-  std::ifstream file(fname, std::ios::binary | std::ios::ate);
-  if (!file.is_open())
+  path._from       = this;
+  path._generation = _document->Generation;
+  path._found      = const_cast<NRS*>(node);
+
+  return node;
+}
+
+// =============================================================================
+
+NRS* NRS::Find(const Path& path)
+{
+  return const_cast<NRS*>(std::as_const(*this).Find(path));
+}
+
+// =============================================================================
+
+uint64_t NRS::NextGeneration()
+{
+  static std::atomic<uint64_t> counter{ 0 };
+
+  return ++counter;
+}
+
+// =============================================================================
+
+NRS* NRS::FindChild(std::string_view name) const
+{
+  return FindChild(name,
+                   (_index != nullptr)
+                   ? std::hash<std::string_view>()(name)
+                   : 0);
+}
+
+// =============================================================================
+
+NRS* NRS::FindChild(std::string_view name, size_t hash) const
+{
+  if (_index == nullptr)
   {
-    res = LoadResult::ERROR;
-    return res;
-  }
+    for (NRS* child = _firstChild; child != nullptr; child = child->_nextSibling)
+    {
+      if (child->_name == name)
+      {
+        return child;
+      }
+    }
 
+    return nullptr;
+  }
 
-  file.seekg(0, std::ios::end);
-  auto fsize = file.tellg();
-  file.seekg(0, std::ios::beg);
+  const size_t mask = _indexCapacity - 1;
 
-  std::string buf(fsize, '\0');
+  size_t slot = hash & mask;
 
-  while(file.read(&buf[0], fsize))
+  while (_index[slot] != nullptr)
   {
-    ss << buf;
+    if (_index[slot]->_name == name)
+    {
+      return _index[slot];
+    }
+
+    slot = (slot + 1) & mask;
   }
 
-  file.close();
+  return nullptr;
+}
+
+// =============================================================================
 
-  loaded = ss.str();
+NRS& NRS::AddChild(std::string_view name)
+{
+  Arena& arena = Storage();
+
+  NRS* child = new (arena.Allocate(sizeof(NRS), alignof(NRS))) NRS(_document, name);
 
-  if (CheckSyntax(loaded))
+  if (_lastChild == nullptr)
   {
-    FromStringObject(loaded);
+    _firstChild = child;
   }
   else
   {
-    res = LoadResult::INVALID_FORMAT;
+    _lastChild->_nextSibling = child;
   }
 
-  return res;
+  _lastChild = child;
+
+  _childrenCount++;
+
+  if (_index != nullptr)
+  {
+    AddToIndex(child);
+  }
+  else if (_childrenCount > kIndexThreshold)
+  {
+    for (NRS* c = _firstChild; c != nullptr; c = c->_nextSibling)
+    {
+      AddToIndex(c);
+    }
+  }
+
+  return *child;
 }
 
 // =============================================================================
 
-std::string NRS::MakeOneliner(const std::string& stringObject)
+NRS& NRS::GetOrAddChild(std::string_view name)
 {
-  std::stringstream ss;
+  NRS* child = FindChild(name);
 
-  bool inQuotes = false;
+  return (child != nullptr) ? *child : AddChild(name);
+}
 
-  for (auto& c : stringObject)
+// =============================================================================
+
+void NRS::AddToIndex(NRS* child)
+{
+  //
+  // Kept at most half full. Old table is left in arena when it grows,
+  // which is at most as much as the current one takes.
+  //
+  if ((_childrenCount * 2) > _indexCapacity)
   {
-    bool unwantedFound = std::find(_unwantedCharacters.begin(),
-                                   _unwantedCharacters.end(),
-                                   c) != _unwantedCharacters.end();
+    size_t oldCapacity = _indexCapacity;
+
+    NRS** oldIndex = _index;
+
+    _indexCapacity = std::max((uint32_t)32, _indexCapacity * 2);
+
+    while ((_childrenCount * 2) > _indexCapacity)
+    {
+      _indexCapacity *= 2;
+    }
+
+    _index = Storage().AllocateArray<NRS*>(_indexCapacity);
+
+    std::fill(_index, _index + _indexCapacity, nullptr);
 
-    if (c == '\"')
+    for (size_t i = 0; i < oldCapacity; i++)
     {
-      inQuotes = !inQuotes;
+      if (oldIndex[i] != nullptr)
+      {
+        AddToIndex(oldIndex[i]);
+      }
     }
+  }
+
+  const size_t mask = _indexCapacity - 1;
+
+  size_t slot = std::hash<std::string_view>()(child->_name) & mask;
+
+  while (_index[slot] != nullptr)
+  {
+    slot = (slot + 1) & mask;
+  }
+
+  _index[slot] = child;
+}
+
+// =============================================================================
+
+void NRS::AssignValues(const std::string_view* values, size_t count)
+{
+  //
+  // Parser assigns whole value at once, so it's usually exact size.
+  //
+  if (count > _valuesCapacity)
+  {
+    GrowValues(count);
+  }
+
+  std::copy(values, values + count, _values);
+
+  _valuesCount = std::max(_valuesCount, (uint32_t)count);
+
+  if (_numbers != nullptr)
+  {
+    std::fill(_numbers, _numbers + count, CachedNumber{ NumberType::NONE, 0 });
+  }
+}
+
+// =============================================================================
+
+void NRS::GrowValues(size_t capacity)
+{
+  std::string_view* grown = Storage().AllocateArray<std::string_view>(capacity);
+
+  std::copy(_values, _values + _valuesCount, grown);
+
+  _values         = grown;
+  _valuesCapacity = capacity;
+
+  //
+  // Made again in new size when needed.
+  //
+  _numbers = nullptr;
+}
+
+// =============================================================================
+
+// =============================================================================
+
+const char* NRS::LoadResultToString(LoadResult res)
+{
+  switch (res)
+  {
+    case LoadResult::LOAD_OK:
+      return "LOAD_OK";
+      break;
+
+    case LoadResult::ERROR:
+      return "ERROR";
+      break;
+
+    case LoadResult::INVALID_FORMAT:
+      return "INVALID_FORMAT";
+      break;
+
+    default:
+      return "UNEXPECTED_CODE";
+      break;
+  }
+}
+
+// =============================================================================
+
+NRS::LoadResult NRS::Load(const std::string& fname)
+{
+  LoadResult res = LoadResult::LOAD_OK;
+
+  auto file = std::make_unique<MappedFile>(fname);
+  if (!file->IsOpen())
+  {
+    res = LoadResult::ERROR;
+    return res;
+  }
+
+  Clear();
+
+  std::string_view text = file->Data();
+
+  //
+  // Parsing goes straight from the mapped file and root keeps it open,
+  // since tree has views into it. Child node can't own it, so it gets
+  // a copy.
+  //
+  if (_ownDocument == nullptr && _document != nullptr)
+  {
+    text = Storage().Store(text);
+  }
+  else
+  {
+    Storage();
+    _document->Source = std::move(file);
+  }
 
-    if (inQuotes || !unwantedFound)
-    {
-      ss << c;
-    }
+  if (!Parse(text, true))
+  {
+    Clear();
+    res = LoadResult::INVALID_FORMAT;
   }
 
-  return ss.str();
+  return res;
 }
 
 // =============================================================================
 
 std::string NRS::ToStringObject()
 {
-  _currentIndent = 0;
   std::stringstream ss;
   WriteIntl(*this, ss);
   return ss.str();
@@ -229,28 +782,30 @@ std::string NRS::ToStringObject()
 
 void NRS::WriteIntl(const NRS& d, std::stringstream& ss)
 {
-  for (auto& item : d._children)
+  for (const NRS* child = d._firstChild;
+       child != nullptr;
+       child = child->_nextSibling)
   {
-    if (item.second._children.empty())
+    if (child->_childrenCount == 0)
     {
-      size_t nItems = item.second.ValuesCount();
+      size_t nItems = child->ValuesCount();
 
       //
       // Empty object.
       //
       if (nItems == 0)
       {
-        ss << item.first << ":{}";
+        ss << child->_name << ":{}";
       }
       else
       {
-        ss << item.first << ":";
+        ss << child->_name << ":";
 
         for (size_t i = 0; i < nItems; i++)
         {
           bool itemsLeft = ((nItems - i) > 1);
 
-          const std::string& str = item.second.GetString(i);
+          std::string_view str = child->GetString(i);
 
           size_t x = str.find_first_of("/ ,");
 
@@ -258,7 +813,7 @@ void NRS::WriteIntl(const NRS& d, std::stringstream& ss)
           // Empty string goes as "" in file so that it can pass syntax check
           // and could subsequently be read back correctly.
           //
-          if (str.empty() || x != std::string::npos)
+          if (str.empty() || x != std::string_view::npos)
           {
             ss << "\"" << str << "\"" << (itemsLeft ? "/" : "");
           }
@@ -273,25 +828,18 @@ void NRS::WriteIntl(const NRS& d, std::stringstream& ss)
     }
     else
     {
-      ss << item.first << ":{";
-
-      _currentIndent++;
+      ss << child->_name << ":{";
 
-      WriteIntl(item.second, ss);
+      WriteIntl(*child, ss);
 
       ss << "},";
     }
   }
-
-  if (_currentIndent > 0)
-  {
-    _currentIndent--;
-  }
 }
 
 // =============================================================================
 
-void NRS::FromStringObject(const std::string& so)
+bool NRS::FromStringObject(std::string_view so)
 {
   //
   // Just in case.
@@ -299,524 +847,306 @@ void NRS::FromStringObject(const std::string& so)
   Clear();
 
   //
-  // And this one too.
+  // Tree keeps views into the text, so it has to live as long as the tree.
   //
-  std::string oneliner = MakeOneliner(so);
-
-  std::string key;
-  std::string value;
-
-  std::stack<NRS*> tree;
-  tree.push(this);
-
-  bool inQuotesTop = false;
+  return Parse(Storage().Store(so), true);
+}
 
-  std::stringstream ss;
-  for (auto& c : oneliner)
-  {
-    switch(c)
-    {
-      case '\"':
-        inQuotesTop = !inQuotesTop;
-        ss << c;
-        break;
+// =============================================================================
 
-      case ':':
-        key = ss.str();
-        ss.str(std::string());
-        break;
+bool NRS::CheckSyntax(std::string_view so)
+{
+  return Parse(so, false);
+}
 
-      case ',':
-      {
-        if (inQuotesTop)
-        {
-          ss << c;
-        }
-        else
-        {
-          value = ss.str();
+// =============================================================================
 
-          bool inQuotes = false;
+bool NRS::Parse(std::string_view so, bool build)
+{
+  ParsingState state = ParsingState::UNDEFINED;
 
-          std::string valueItem;
+  size_t scopeCount = 0;
 
-          size_t valueIndex = 0;
+  std::vector<NRS*> tree;
+  tree.push_back(this);
 
-          bool listFound = false;
+  //
+  // Whitespace outside of quotes is ignored even inside keys and values,
+  // so "some key" is the same as "somekey". Such tokens are the only ones
+  // that can't be just a view into the text and are glued into arena.
+  //
+  size_t tokenBegin = 0;
+  size_t tokenEnd   = 0;
 
-          //
-          // Check if it's a list.
-          //
-          for (auto& ch : value)
-          {
-            switch (ch)
-            {
-              case '\"':
-                inQuotes = !inQuotes;
-                break;
-
-              default:
-              {
-                if (inQuotes)
-                {
-                  valueItem.append(1, ch);
-                }
-                else
-                {
-                  if (ch == '/')
-                  {
-                    listFound = true;
-
-                    (*tree.top())[key].SetString(valueItem, valueIndex);
-                    valueIndex++;
-                    valueItem.clear();
-                  }
-                  else
-                  {
-                    valueItem.append(1, ch);
-                  }
-                }
-              }
-              break;
-            }
-          }
+  bool tokenSplit = false;
 
-          //
-          // At this point valueItem is either a leftover from list parsing,
-          // or just a value.
-          //
-          if (listFound)
-          {
-            (*tree.top())[key].SetString(valueItem, valueIndex);
-          }
-          else
-          {
-            //
-            // If it wasn't a list but we got nothing, don't create a node.
-            //
-            if (!valueItem.empty())
-            {
-              (*tree.top())[key].SetString(valueItem, valueIndex);
-            }
-          }
+  std::string_view key;
+  std::string_view item;
 
-          ss.str(std::string());
-        }
-      }
-      break;
+  //
+  // Items of the value being read. Value node is created only once we know
+  // it's either a list or a non-empty value.
+  //
+  std::vector<std::string_view> items;
 
-      case '{':
-      {
-        tree.push(&(*tree.top())[key]);
-        ss.str(std::string());
-      }
-      break;
+  bool listFound = false;
 
-      case '}':
-      {
-        if (!tree.empty())
-        {
-          tree.pop();
-        }
+  auto StartToken = [&](size_t pos)
+  {
+    tokenBegin = pos;
+    tokenEnd   = pos + 1;
+    tokenSplit = false;
+  };
 
-        ss.str(std::string());
-      }
-      break;
+  auto Token = [&]()
+  {
+    std::string_view token = so.substr(tokenBegin, tokenEnd - tokenBegin);
 
-      default:
-        ss << c;
-        break;
+    if (!tokenSplit || !build)
+    {
+      return token;
     }
-  }
-}
 
-// =============================================================================
+    char* glued = Storage().AllocateArray<char>(token.size());
 
-bool NRS::CheckSyntax(const std::string& so)
-{
-  std::string oneliner = MakeOneliner(so);
+    size_t length = 0;
 
-  _parsingState = ParsingState::UNDEFINED;
+    for (char c : token)
+    {
+      if (ClassOf(c) != CHAR_WHITESPACE)
+      {
+        glued[length++] = c;
+      }
+    }
 
-  std::stringstream ss;
+    return std::string_view(glued, length);
+  };
 
-  size_t index = 0;
+  auto StartValue = [&]()
+  {
+    items.clear();
+    listFound = false;
+  };
 
-  for (auto& c : oneliner)
+  auto AddListItem = [&]()
   {
-    DriveStateMachine(c);
+    listFound = true;
 
-    if (_parsingState == ParsingState::ERROR)
+    if (build)
     {
-      break;
+      items.push_back(item);
     }
+  };
 
-    index++;
-  }
-
-  //
-  // To handle negative case:
-  //
-  // obj : { key : value,
-  //
-  bool success = (_parsingState == ParsingState::VALUE_DONE
-               && _parsingScopeCount == 0);
-
-  _parsingState = success ? ParsingState::PARSING_OK : ParsingState::ERROR;
-
-  return (_parsingState == ParsingState::PARSING_OK);
-}
-
-// =============================================================================
-
-void NRS::DriveStateMachine(const char currentChar, bool debug)
-{
-  if (debug)
+  auto FinishValue = [&]()
   {
-    printf("%c\n", currentChar);
-  }
+    //
+    // If it wasn't a list but we got nothing, don't create a node.
+    //
+    if (build && (listFound || !item.empty()))
+    {
+      items.push_back(item);
 
-  auto IsValidChar = [this](const char c)
-  {
-    return (c > 32 && c < 127 && _transitionChars.count(c) == 0);
+      tree.back()->GetOrAddChild(key).AssignValues(items.data(), items.size());
+    }
   };
 
-  switch (_parsingState)
+  const size_t length = so.length();
+
+  for (size_t i = 0; i < length && state != ParsingState::ERROR; i++)
   {
-    // -------------------------------------------------------------------------
+    const char c = so[i];
 
-    case ParsingState::UNDEFINED:
+    //
+    // Everything up to closing quote goes as is.
+    //
+    if (state == ParsingState::READING_VALUE_Q)
     {
-      if (IsValidChar(currentChar))
+      size_t closing = so.find('\"', i);
+      if (closing == std::string_view::npos)
       {
-        _parsingState = ParsingState::READING_KEY;
-
-        if (debug)
-        {
-          printf("UNDEFINED -> READING_KEY\n");
-        }
+        break;
       }
-      else
-      {
-        _parsingState = ParsingState::ERROR;
 
-      }
+      item = so.substr(i, closing - i);
+
+      i = closing;
+
+      state = ParsingState::VALUE_Q_DONE;
+
+      continue;
     }
-    break;
 
-    // -------------------------------------------------------------------------
+    const uint8_t cls = ClassOf(c);
 
-    case ParsingState::READING_KEY:
+    if (cls == CHAR_WHITESPACE)
     {
-      if (currentChar == ':')
-      {
-        _parsingState = ParsingState::KEY_DONE;
+      continue;
+    }
 
-        if (debug)
-        {
-          printf("READING_KEY -> KEY_DONE\n");
-        }
-      }
-      else
+    //
+    // Unquoted key or value continues, read it all at once.
+    //
+    if (cls == CHAR_VALID
+     && (state == ParsingState::READING_KEY
+      || state == ParsingState::READING_VALUE))
+    {
+      tokenSplit = tokenSplit || (tokenEnd != i);
+
+      while (i + 1 < length && ClassOf(so[i + 1]) == CHAR_VALID)
       {
-        if (!IsValidChar(currentChar))
-        {
-          _parsingState = ParsingState::ERROR;
-        }
+        i++;
       }
-    }
-    break;
 
-    // -------------------------------------------------------------------------
+      tokenEnd = i + 1;
+
+      continue;
+    }
 
-    case ParsingState::KEY_DONE:
+    switch (state)
     {
-      if (currentChar == '\"')
-      {
-        _parsingState = ParsingState::READING_VALUE_Q;
+      // -----------------------------------------------------------------------
 
-        if (debug)
-        {
-          printf("KEY_DONE -> READING_VALUE_Q\n");
-        }
-      }
-      else if (currentChar == '{')
+      case ParsingState::UNDEFINED:
+      case ParsingState::VALUE_DONE:
+      case ParsingState::READING_OBJECT:
       {
-        _parsingScopeCount++;
-        _parsingState = ParsingState::READING_OBJECT;
-
-        if (debug)
+        if (c == '}' && state != ParsingState::UNDEFINED && scopeCount > 0)
         {
-          printf("KEY_DONE -> READING_OBJECT\n");
+          scopeCount--;
+          tree.pop_back();
+          state = ParsingState::OBJECT_DONE;
         }
-      }
-      else
-      {
-        if (IsValidChar(currentChar))
+        else if (cls == CHAR_VALID)
         {
-          _parsingState = ParsingState::READING_VALUE;
-
-          if (debug)
-          {
-            printf("KEY_DONE -> READING_VALUE\n");
-          }
+          StartToken(i);
+          state = ParsingState::READING_KEY;
         }
         else
         {
-          _parsingState = ParsingState::ERROR;
+          state = ParsingState::ERROR;
         }
       }
-    }
-    break;
+      break;
 
-    // -------------------------------------------------------------------------
+      // -----------------------------------------------------------------------
 
-    case ParsingState::READING_VALUE:
-    {
-      switch (currentChar)
+      case ParsingState::READING_KEY:
       {
-        case ',':
-        {
-          _parsingState = ParsingState::VALUE_DONE;
-
-          if (debug)
-          {
-            printf("READING_VALUE -> VALUE_DONE\n");
-          }
-        }
-        break;
-
-        case '/':
+        if (c == ':')
         {
-          _parsingState = ParsingState::READING_LIST;
-
-          if (debug)
-          {
-            printf("READING_VALUE -> READING_LIST\n");
-          }
+          key = Token();
+          state = ParsingState::KEY_DONE;
         }
-        break;
-
-        default:
+        else
         {
-          if (!IsValidChar(currentChar))
-          {
-            _parsingState = ParsingState::ERROR;
-          }
+          state = ParsingState::ERROR;
         }
-        break;
       }
-    }
-    break;
+      break;
 
-    // -------------------------------------------------------------------------
+      // -----------------------------------------------------------------------
 
-    case ParsingState::VALUE_DONE:
-    {
-      switch (currentChar)
+      case ParsingState::KEY_DONE:
       {
-        case '}':
+        if (c == '\"')
         {
-          if (_parsingScopeCount > 0)
-          {
-            _parsingScopeCount--;
-            _parsingState = ParsingState::OBJECT_DONE;
-
-            if (debug)
-            {
-              printf("VALUE_DONE -> OBJECT_DONE\n");
-            }
-          }
-          else
-          {
-            _parsingState = ParsingState::ERROR;
-          }
+          StartValue();
+          state = ParsingState::READING_VALUE_Q;
         }
-        break;
-
-        default:
+        else if (c == '{')
         {
-          if (IsValidChar(currentChar))
-          {
-            _parsingState = ParsingState::READING_KEY;
+          scopeCount++;
 
-            if (debug)
-            {
-              printf("VALUE_DONE -> READING_KEY\n");
-            }
-          }
-          else
-          {
-            _parsingState = ParsingState::ERROR;
-          }
+          tree.push_back(build ? &tree.back()->GetOrAddChild(key) : this);
+
+          state = ParsingState::READING_OBJECT;
+        }
+        else if (cls == CHAR_VALID)
+        {
+          StartValue();
+          StartToken(i);
+          state = ParsingState::READING_VALUE;
+        }
+        else
+        {
+          state = ParsingState::ERROR;
         }
-        break;
       }
-    }
-    break;
+      break;
 
-    // -------------------------------------------------------------------------
+      // -----------------------------------------------------------------------
 
-    case ParsingState::READING_OBJECT:
-    {
-      switch (currentChar)
+      case ParsingState::READING_VALUE:
+      case ParsingState::VALUE_Q_DONE:
       {
-        //
-        // This is an empty object.
-        //
-        case '}':
+        if (c == ',' || c == '/')
         {
-          if (_parsingScopeCount > 0)
-          {
-            _parsingScopeCount--;
-            _parsingState = ParsingState::OBJECT_DONE;
-
-            if (debug)
-            {
-              printf("READING_OBJECT -> OBJECT_DONE\n");
-            }
-          }
-          else
+          if (state == ParsingState::READING_VALUE)
           {
-            _parsingState = ParsingState::ERROR;
+            item = Token();
           }
-        }
-        break;
 
-        default:
-        {
-          if (IsValidChar(currentChar))
+          if (c == ',')
           {
-            _parsingState = ParsingState::READING_KEY;
-
-            if (debug)
-            {
-              printf("READING_OBJECT -> READING_KEY\n");
-            }
+            FinishValue();
+            state = ParsingState::VALUE_DONE;
           }
           else
           {
-            _parsingState = ParsingState::ERROR;
+            AddListItem();
+            state = ParsingState::READING_LIST;
           }
         }
-        break;
-      }
-    }
-    break;
-
-    // -------------------------------------------------------------------------
-
-    case ParsingState::OBJECT_DONE:
-    {
-      switch (currentChar)
-      {
-        case ',':
+        else
         {
-          _parsingState = ParsingState::VALUE_DONE;
-
-          if (debug)
-          {
-            printf("OBJECT_DONE -> VALUE_DONE\n");
-          }
+          state = ParsingState::ERROR;
         }
-        break;
-
-        default:
-          _parsingState = ParsingState::ERROR;
-          break;
       }
-    }
-    break;
+      break;
 
-    // -------------------------------------------------------------------------
+      // -----------------------------------------------------------------------
 
-    case ParsingState::READING_VALUE_Q:
-    {
-      if (currentChar == '\"')
+      case ParsingState::OBJECT_DONE:
       {
-        _parsingState = ParsingState::VALUE_Q_DONE;
-
-        if (debug)
-        {
-          printf("READING_VALUE_Q -> VALUE_Q_DONE\n");
-        }
+        state = (c == ',') ? ParsingState::VALUE_DONE : ParsingState::ERROR;
       }
-    }
-    break;
+      break;
 
-    // -------------------------------------------------------------------------
+      // -----------------------------------------------------------------------
 
-    case ParsingState::VALUE_Q_DONE:
-    {
-      switch(currentChar)
+      case ParsingState::READING_LIST:
       {
-        case ',':
+        if (c == '\"')
         {
-          _parsingState = ParsingState::VALUE_DONE;
-
-          if (debug)
-          {
-            printf("VALUE_Q_DONE -> VALUE_DONE\n");
-          }
+          state = ParsingState::READING_VALUE_Q;
         }
-        break;
-
-        case '/':
+        else if (cls == CHAR_VALID)
         {
-          _parsingState = ParsingState::READING_LIST;
-
-          if (debug)
-          {
-            printf("VALUE_Q_DONE -> READING_LIST\n");
-          }
+          StartToken(i);
+          state = ParsingState::READING_VALUE;
         }
-        break;
-
-        default:
-          _parsingState = ParsingState::ERROR;
-          break;
-      }
-    }
-    break;
-
-    // -------------------------------------------------------------------------
-
-    case ParsingState::READING_LIST:
-    {
-      switch(currentChar)
-      {
-        case '\"':
+        else
         {
-          _parsingState = ParsingState::READING_VALUE_Q;
-
-          if (debug)
-          {
-            printf("READING_LIST -> READING_VALUE_Q\n");
-          }
+          state = ParsingState::ERROR;
         }
-        break;
+      }
+      break;
 
-        default:
-        {
-          if (IsValidChar(currentChar))
-          {
-            _parsingState = ParsingState::READING_VALUE;
+      // -----------------------------------------------------------------------
 
-            if (debug)
-            {
-              printf("READING_LIST -> READING_VALUE\n");
-            }
-          }
-          else
-          {
-            _parsingState = ParsingState::ERROR;
-          }
-        }
+      default:
+        state = ParsingState::ERROR;
         break;
-      }
     }
-    break;
   }
+
+  //
+  // To handle negative case:
+  //
+  // obj : { key : value,
+  //
+  return (state == ParsingState::VALUE_DONE && scopeCount == 0);
 }
 
 // =============================================================================
@@ -916,10 +1246,10 @@ std::string NRS::DumpObjectStructureToString()
 
       char buf[32];
 
-      for (auto& item : node->_content)
+      for (size_t i = 0; i < node->_valuesCount; i++)
       {
-        sprintf(buf, "0x%X", &item);
-        ss << indentation << item << " (" << buf << ")\n";
+        snprintf(buf, sizeof(buf), "%p", (const void*)&node->_values[i]);
+        ss << indentation << node->_values[i] << " (" << buf << ")\n";
       }
     }
     else
@@ -928,17 +1258,19 @@ std::string NRS::DumpObjectStructureToString()
 
       char buf[32];
 
-      for (auto& p : node->_children)
+      for (NRS* child = node->_firstChild;
+           child != nullptr;
+           child = child->_nextSibling)
       {
-        sprintf(buf, "0x%X", &p.second);
-        ss << indentation << "'" << p.first << "'" << " (" << buf << ")" << "\n";
-        DumpIntl(&p.second, ss, indent + 2);
+        snprintf(buf, sizeof(buf), "%p", (const void*)child);
+        ss << indentation << "'" << child->_name << "'" << " (" << buf << ")" << "\n";
+        DumpIntl(child, ss, indent + 2);
       }
     }
   };
 
   char buf[32];
-  sprintf(buf, "0x%X", this);
+  snprintf(buf, sizeof(buf), "%p", (const void*)this);
   ss << "--- start of [NRS] (" << buf << ") ---\n";
 
   DumpIntl(this, ss, 0);
@@ -4,12 +4,16 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
-#include <stack>
-#include <set>
+#include <memory>
+#include <optional>
+
+#include "arena.h"
+#include "mapped-file.h"
 
 //
 // Based on savefile class courtesy of OneLoneCoder video:
@@ -46,16 +50,63 @@
 // with '/'. If list item itself contains '/' and/or ',' then the whole item
 // will be enclosed in quotes, as it is shown in the example above.
 //
+// The whole tree lives in an arena owned by the root node: nodes, their
+// value arrays, and keys and values set through the API. Keys and values
+// read by Load() are views straight into the mapped file, which root keeps
+// open, and FromStringObject() makes one copy of the text for the same
+// purpose. Everything is freed at once when root is cleared or destroyed,
+// so references to nodes and views returned by GetString() stay valid
+// until then.
+//
 class NRS
 {
   public:
-    void SetString(const std::string& s, size_t index = 0);
-    const std::string& GetString(size_t index = 0) const;
+    NRS() = default;
 
-    void SetInt(int64_t value, size_t index = 0);
-    int64_t GetInt(size_t index = 0) const;
+    NRS(const NRS&) = delete;
+    NRS& operator=(const NRS&) = delete;
+
+    void SetString(std::string_view s, size_t index = 0);
+    std::string_view GetString(size_t index = 0) const;
+
+    //
+    // Typed getters never throw: empty result means there's no such value
+    // or it isn't entirely a number of that type.
+    //
+    std::optional<int64_t>  TryGetInt(size_t index = 0) const;
+    std::optional<uint64_t> TryGetUInt(size_t index = 0) const;
+    std::optional<double>   TryGetDouble(size_t index = 0) const;
+
+    //
+    // "true", "false" or integer, non-zero is true.
+    //
+    std::optional<bool> TryGetBool(size_t index = 0) const;
+
+    struct RGB
+    {
+      uint8_t R = 0;
+      uint8_t G = 0;
+      uint8_t B = 0;
+    };
+
+    //
+    // Three values starting from index, 0 - 255 each.
+    //
+    std::optional<RGB> TryGetRGB(size_t index = 0) const;
+
+    //
+    // Makes typed getters of the whole tree remember parsed numbers,
+    // for values that are read over and over. Off by default.
+    //
+    void CacheNumbers(bool enable);
 
+    void SetInt(int64_t value, size_t index = 0);
     void SetUInt(uint64_t value, size_t index = 0);
+
+    //
+    // 0 if there's no such value or it isn't a number.
+    //
+    int64_t  GetInt(size_t index = 0) const;
     uint64_t GetUInt(size_t index = 0) const;
 
     void Clear();
@@ -63,20 +114,68 @@ class NRS
     size_t ValuesCount() const;
     size_t ChildrenCount() const;
 
-    bool Has(const std::string& nodeName);
+    bool Has(std::string_view nodeName) const;
 
-    NRS& operator[](const std::string& nodeName);
+    //
+    // Adds empty node if there's no such child.
+    //
+    NRS& operator[](std::string_view nodeName);
 
     //
     // For more readable access to inner elements, e.g. "object.inventory"
-    // instead of ["object"]["inventory"]
+    // instead of ["object"]["inventory"]. Adds whatever is missing
+    // along the way, same as operator[].
+    //
+    NRS& GetNode(std::string_view path);
+
+    //
+    // Dotted path split and hashed once, for lookups repeated in hot code.
+    // Also remembers the node it was last found at, which stays valid
+    // until that tree is cleared, so next Find() from the same node
+    // doesn't search at all.
+    //
+    // Not meant to be shared between threads.
+    //
+    class Path
+    {
+      public:
+        explicit Path(std::string_view path);
+
+      private:
+        friend class NRS;
+
+        struct Segment
+        {
+          std::string Name;
+          size_t      Hash;
+        };
+
+        std::vector<Segment> _segments;
+
+        mutable const NRS* _from       = nullptr;
+        mutable uint64_t   _generation = 0;
+        mutable NRS*       _found      = nullptr;
+    };
+
+    //
+    // Same as GetNode() but never adds anything, nullptr if there's
+    // no such node.
     //
-    NRS& GetNode(const std::string& path);
+    const NRS* Find(std::string_view path) const;
+    NRS*       Find(std::string_view path);
+
+    const NRS* Find(const Path& path) const;
+    NRS*       Find(const Path& path);
 
     std::string ToStringObject();
-    void FromStringObject(const std::string& so);
 
-    bool CheckSyntax(const std::string& so);
+    //
+    // Returns false on syntax error, with whatever was read before it
+    // left in the tree.
+    //
+    bool FromStringObject(std::string_view so);
+
+    bool CheckSyntax(std::string_view so);
 
     enum class LoadResult
     {
@@ -97,45 +196,136 @@ class NRS
     std::string DumpObjectStructureToString();
 
   private:
-    std::string MakeOneliner(const std::string& stringObject);
+    struct Document;
+
+    explicit NRS(Document* document, std::string_view name);
+
+    Arena& Storage();
+
+    NRS* FindChild(std::string_view name) const;
+
+    //
+    // hash is std::hash of name, only used if there's an index.
+    //
+    NRS* FindChild(std::string_view name, size_t hash) const;
+
+    //
+    // name must already be in arena or source text.
+    //
+    NRS& AddChild(std::string_view name);
+
+    NRS& GetOrAddChild(std::string_view name);
+
+    void AddToIndex(NRS* child);
+
+    //
+    // Sets values [0, count) to views that already live as long as the tree.
+    //
+    void AssignValues(const std::string_view* values, size_t count);
+
+    void GrowValues(size_t capacity);
+
+    enum class NumberType : uint8_t
+    {
+      NONE = 0,
+      INT,
+      UINT,
+      DOUBLE
+    };
+
+    //
+    // Parsed value, T in Bits as is.
+    //
+    struct CachedNumber
+    {
+      NumberType Type;
+      uint64_t   Bits;
+    };
+
+    template <typename T>
+    std::optional<T> GetNumber(size_t index,
+                               NumberType type,
+                               bool (*parse)(std::string_view, T&)) const;
 
     void WriteIntl(const NRS& d, std::stringstream& ss);
 
-    void DriveStateMachine(const char currentChar, bool debug = false);
+    //
+    // Checks syntax and, if build is true, fills this node at the same time,
+    // in one pass over the text without making any copies of it.
+    //
+    bool Parse(std::string_view so, bool build);
+
+    struct Document
+    {
+      Arena Storage;
+
+      //
+      // Text loaded tree keeps views into.
+      //
+      std::unique_ptr<MappedFile> Source;
+
+      bool CacheNumbers = false;
+
+      //
+      // Changes every time nodes may be gone, so that Path knows its
+      // remembered node is no longer there. Unique across all documents.
+      //
+      uint64_t Generation = 0;
+    };
+
+    static uint64_t NextGeneration();
 
     //
-    // Contains value elements (after ':' symbol).
+    // Only root has it.
     //
-    std::vector<std::string> _content;
+    std::unique_ptr<Document> _ownDocument;
 
     //
-    // We need to preserve serial order of data nodes added to our save data
-    // instance, so we use vector. We can't use map since it's sorted by string
-    // and we cannot use unordered_map since it doesn't guarantee order at all.
-    // But we still need to access our nodes somehow. So the only way to do this
-    // while preserving serial order is by using indices in a vector.
-    // And since we're using indices there's no danger of "losing" access due to
-    // vector's relocation in memory because we don't rely on object addresses,
-    // just on their serial order.
-    // Also "humans like to group things", so we can put data in a file in
-    // whatever order that seems comfortable for us.
+    // Root's document, shared by the whole tree.
     //
-    std::vector<std::pair<std::string, NRS>> _children;
+    Document* _document = nullptr;
 
     //
-    // Mapping of children node names to their respective index
-    // in a vector of children.
+    // Key this node has in its parent.
     //
-    std::unordered_map<std::string, size_t> _childIndexByName;
+    std::string_view _name;
 
     //
-    // For writing to file.
+    // Value elements (after ':' symbol).
     //
-    size_t _currentIndent = 0;
+    std::string_view* _values = nullptr;
+
+    uint32_t _valuesCount    = 0;
+    uint32_t _valuesCapacity = 0;
 
-    const std::string kEmptyString;
+    //
+    // Same size as _values, only allocated once typed getter is called
+    // with number caching on.
+    //
+    mutable CachedNumber* _numbers = nullptr;
 
-    const std::string _unwantedCharacters = " \t\n\r\f\v";
+    //
+    // Children are kept in a list in the order they were added, because
+    // humans like to group things, so we can put data in a file in whatever
+    // order that seems comfortable for us, and it should stay that way
+    // when written back.
+    //
+    NRS* _firstChild  = nullptr;
+    NRS* _lastChild   = nullptr;
+    NRS* _nextSibling = nullptr;
+
+    uint32_t _childrenCount = 0;
+
+    //
+    // Nodes with more than kIndexThreshold children get an open addressing
+    // hash table of them to find children by name, smaller ones are
+    // searched through linearly.
+    //
+    static constexpr size_t kIndexThreshold = 8;
+
+    uint32_t _indexCapacity = 0;
+
+    NRS** _index = nullptr;
 
     enum class ParsingState
     {
@@ -155,15 +345,6 @@ class NRS
       PARSING_OK,
       ERROR
     };
-
-    //
-    // For checking syntax.
-    //
-    size_t _parsingScopeCount = 0;
-
-    ParsingState _parsingState = ParsingState::UNDEFINED;
-
-    const std::set<char> _transitionChars = { ':', '{', '}', ',', '"', '/' };
 };
 
 #endif // NRS_H
@@ -0,0 +1,237 @@
+#include "palette-kernel.h"
+
+#include <SDL2/SDL.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define PALETTE_KERNEL_X86
+  #include <immintrin.h>
+#endif
+
+//
+// MSVC allows intrinsics of any instruction set without special flags,
+// GCC and Clang need the function to be marked.
+//
+#if defined(PALETTE_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+  #define TARGET_AVX2 __attribute__((target("avx2")))
+  #define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+  #define TARGET_AVX2
+  #define TARGET_SSE2
+#endif
+
+namespace
+{
+  void ResolveScalar(const uint8_t* indices,
+                     const uint32_t* trueColors,
+                     const uint16_t* columns,
+                     const uint32_t* lut,
+                     uint32_t* out,
+                     size_t n)
+  {
+    if (trueColors == nullptr)
+    {
+      for (size_t x = 0; x < n; x++)
+      {
+        out[x] = lut[indices[columns[x]]];
+      }
+
+      return;
+    }
+
+    for (size_t x = 0; x < n; x++)
+    {
+      const uint16_t ix = columns[x];
+
+      uint32_t c = lut[indices[ix]];
+
+      //
+      // All ones if not in palette, zero otherwise.
+      //
+      uint32_t mask = (uint32_t)0 - (uint32_t)(c == 0);
+
+      out[x] = c | (trueColors[ix] & mask);
+    }
+  }
+
+#ifdef PALETTE_KERNEL_X86
+
+  // ---------------------------------------------------------------------------
+
+  //
+  // There are no gathers in SSE2, so loads are still scalar, but compare and
+  // blend are done for 4 pixels at once. Without blend there's nothing to
+  // vectorize, so it's just scalar version.
+  //
+  TARGET_SSE2
+  void ResolveSSE2(const uint8_t* indices,
+                   const uint32_t* trueColors,
+                   const uint16_t* columns,
+                   const uint32_t* lut,
+                   uint32_t* out,
+                   size_t n)
+  {
+    if (trueColors == nullptr)
+    {
+      ResolveScalar(indices, trueColors, columns, lut, out, n);
+      return;
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t x = 0;
+
+    for (; x + 4 <= n; x += 4)
+    {
+      const uint16_t c0 = columns[x];
+      const uint16_t c1 = columns[x + 1];
+      const uint16_t c2 = columns[x + 2];
+      const uint16_t c3 = columns[x + 3];
+
+      __m128i colors = _mm_set_epi32(lut[indices[c3]],
+                                     lut[indices[c2]],
+                                     lut[indices[c1]],
+                                     lut[indices[c0]]);
+
+      __m128i passthrough = _mm_set_epi32(trueColors[c3],
+                                          trueColors[c2],
+                                          trueColors[c1],
+                                          trueColors[c0]);
+
+      __m128i mask = _mm_cmpeq_epi32(colors, zero);
+
+      __m128i res = _mm_or_si128(colors, _mm_and_si128(mask, passthrough));
+
+      _mm_storeu_si128((__m128i*)(out + x), res);
+    }
+
+    ResolveScalar(indices, trueColors, columns + x, lut, out + x, n - x);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  TARGET_AVX2
+  void ResolveAVX2(const uint8_t* indices,
+                   const uint32_t* trueColors,
+                   const uint16_t* columns,
+                   const uint32_t* lut,
+                   uint32_t* out,
+                   size_t n)
+  {
+    const __m256i zero     = _mm256_setzero_si256();
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+
+    size_t x = 0;
+
+    for (; x + 8 <= n; x += 8)
+    {
+      __m128i cols16 = _mm_loadu_si128((const __m128i*)(columns + x));
+      __m256i cols   = _mm256_cvtepu16_epi32(cols16);
+
+      //
+      // 32 bit loads at byte offsets, so only lowest byte is the index.
+      //
+      __m256i ind = _mm256_i32gather_epi32((const int*)indices, cols, 1);
+      ind = _mm256_and_si256(ind, byteMask);
+
+      __m256i colors = _mm256_i32gather_epi32((const int*)lut, ind, 4);
+
+      if (trueColors == nullptr)
+      {
+        _mm256_storeu_si256((__m256i*)(out + x), colors);
+        continue;
+      }
+
+      __m256i passthrough = _mm256_i32gather_epi32((const int*)trueColors,
+                                                   cols,
+                                                   4);
+
+      __m256i mask = _mm256_cmpeq_epi32(colors, zero);
+
+      __m256i res = _mm256_blendv_epi8(colors, passthrough, mask);
+
+      _mm256_storeu_si256((__m256i*)(out + x), res);
+    }
+
+    ResolveScalar(indices, trueColors, columns + x, lut, out + x, n - x);
+  }
+
+#endif // PALETTE_KERNEL_X86
+}
+
+// =============================================================================
+
+bool IsPaletteKernelSupported(PaletteKernelType type)
+{
+  switch (type)
+  {
+    case PaletteKernelType::SCALAR:
+      return true;
+
+#ifdef PALETTE_KERNEL_X86
+    case PaletteKernelType::SSE2:
+      return (SDL_HasSSE2() == SDL_TRUE);
+
+    case PaletteKernelType::AVX2:
+      return (SDL_HasAVX2() == SDL_TRUE);
+#endif
+
+    default:
+      return false;
+  }
+}
+
+// =============================================================================
+
+PaletteKernel GetPaletteKernel(PaletteKernelType type)
+{
+  switch (type)
+  {
+#ifdef PALETTE_KERNEL_X86
+    case PaletteKernelType::SSE2:
+      return ResolveSSE2;
+
+    case PaletteKernelType::AVX2:
+      return ResolveAVX2;
+#endif
+
+    default:
+      return ResolveScalar;
+  }
+}
+
+// =============================================================================
+
+PaletteKernelType SelectPaletteKernel()
+{
+  if (IsPaletteKernelSupported(PaletteKernelType::AVX2))
+  {
+    return PaletteKernelType::AVX2;
+  }
+
+  if (IsPaletteKernelSupported(PaletteKernelType::SSE2))
+  {
+    return PaletteKernelType::SSE2;
+  }
+
+  return PaletteKernelType::SCALAR;
+}
+
+// =============================================================================
+
+const char* PaletteKernelName(PaletteKernelType type)
+{
+  switch (type)
+  {
+    case PaletteKernelType::SCALAR:
+      return "scalar";
+
+    case PaletteKernelType::SSE2:
+      return "SSE2";
+
+    case PaletteKernelType::AVX2:
+      return "AVX2";
+
+    default:
+      return "unknown";
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef PALETTE_KERNEL_H
+#define PALETTE_KERNEL_H
+
+#include <cstdint>
+#include <cstddef>
+
+//
+// Resolves one output scanline of palette indexed background:
+//
+// out[x] = lut[indices[columns[x]]]
+//
+// If trueColors is not null, LUT entry of 0 (which can't be a real color
+// since alpha is always 255) means "not in palette" and
+// trueColors[columns[x]] is taken instead.
+// So both palette rotation and passthrough are just a table load and a blend,
+// without modulo or branch per pixel.
+//
+// Indices row must be readable for 3 more bytes past the last column,
+// since it can be read with 32 bit loads.
+//
+const size_t kPaletteLutSize = 256;
+
+using PaletteKernel = void (*)(const uint8_t* indices,
+                               const uint32_t* trueColors,
+                               const uint16_t* columns,
+                               const uint32_t* lut,
+                               uint32_t* out,
+                               size_t n);
+
+enum class PaletteKernelType
+{
+  SCALAR = 0,
+  SSE2,
+  AVX2,
+  LAST_ELEMENT
+};
+
+bool IsPaletteKernelSupported(PaletteKernelType type);
+
+PaletteKernel GetPaletteKernel(PaletteKernelType type);
+
+//
+// Best supported kernel for CPU we're running on.
+//
+PaletteKernelType SelectPaletteKernel();
+
+const char* PaletteKernelName(PaletteKernelType type);
+
+#endif // PALETTE_KERNEL_H
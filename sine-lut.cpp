@@ -0,0 +1,54 @@
+#include "sine-lut.h"
+
+#include <cmath>
+
+namespace
+{
+  const double kTwoPi = 6.283185307179586;
+
+  struct SineTable
+  {
+    int32_t Values[kSineLutSize];
+
+    SineTable()
+    {
+      //
+      // Values are rounded to 16.16, so last ulp differences between libm
+      // implementations mostly don't end up in the table.
+      //
+      for (uint32_t i = 0; i < kSineLutSize; i++)
+      {
+        double a = kTwoPi * (double)i / (double)kSineLutSize;
+        Values[i] = (int32_t)std::lround(std::sin(a) * (double)kFixedOne);
+      }
+    }
+  };
+
+  const SineTable Table;
+}
+
+const int32_t* SineLut = Table.Values;
+
+// =============================================================================
+
+int32_t ToFixed(double value)
+{
+  return (int32_t)std::lround(value * (double)kFixedOne);
+}
+
+// =============================================================================
+
+uint32_t DegreesToPhase(double degrees)
+{
+  double turns = degrees / 360.0;
+  turns -= std::floor(turns);
+
+  return (uint32_t)(uint64_t)std::llround(turns * 4294967296.0);
+}
+
+// =============================================================================
+
+double PhaseToDegrees(uint32_t phase)
+{
+  return (double)phase * 360.0 / 4294967296.0;
+}
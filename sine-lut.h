@@ -0,0 +1,50 @@
+#ifndef SINE_LUT_H
+#define SINE_LUT_H
+
+#include <cstdint>
+
+//
+// Phase is 16.16 fixed point over a circle of 65536 units, so the whole range
+// of uint32_t is exactly one revolution and wraparound is just unsigned
+// overflow - no drift and no branches.
+//
+// Sine values are stored as 16.16 fixed point too (kFixedOne is 1.0).
+// Table is filled once at startup with std::sin, so it's only as
+// deterministic as the libm it was built with. Rounding to 16.16 hides
+// most of last ulp differences, but an entry near a rounding boundary can
+// still differ by 1 between platforms. Everything after the table lookup
+// is integer only.
+//
+const uint32_t kSineLutBits = 12;
+const uint32_t kSineLutSize = (1u << kSineLutBits);
+
+const int32_t kFixedOne = (1 << 16);
+
+extern const int32_t* SineLut;
+
+// -----------------------------------------------------------------------------
+
+inline int32_t SineFixed(uint32_t phase)
+{
+  return SineLut[phase >> (32 - kSineLutBits)];
+}
+
+// -----------------------------------------------------------------------------
+
+//
+// Product of two 16.16 numbers truncated towards zero to integer, same as
+// (int)(a * b) on doubles.
+//
+inline int32_t FixedMulToInt(int32_t a, int32_t b)
+{
+  int64_t p = (int64_t)a * (int64_t)b;
+  return (p >= 0) ? (int32_t)(p >> 32) : -(int32_t)((-p) >> 32);
+}
+
+// -----------------------------------------------------------------------------
+
+int32_t  ToFixed(double value);
+uint32_t DegreesToPhase(double degrees);
+double   PhaseToDegrees(uint32_t phase);
+
+#endif // SINE_LUT_H
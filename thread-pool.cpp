@@ -0,0 +1,138 @@
+#include "thread-pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadsCount)
+{
+  if (threadsCount == 0)
+  {
+    threadsCount = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  for (size_t i = 1; i < threadsCount; i++)
+  {
+    _workers.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+// =============================================================================
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+
+  _wakeUp.notify_all();
+
+  for (std::thread& t : _workers)
+  {
+    t.join();
+  }
+}
+
+// =============================================================================
+
+void ThreadPool::ParallelFor(size_t count,
+                             const std::function<void(size_t)>& job)
+{
+  if (count == 0)
+  {
+    return;
+  }
+
+  if (_workers.empty() or count == 1)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      job(i);
+    }
+
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _job         = &job;
+    _jobSize     = count;
+    _busyWorkers = _workers.size();
+
+    _nextIndex.store(0);
+
+    _generation++;
+  }
+
+  _wakeUp.notify_all();
+
+  RunJobs();
+
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  _done.wait(lock, [this]() { return _busyWorkers == 0; });
+
+  _job = nullptr;
+}
+
+// =============================================================================
+
+size_t ThreadPool::ThreadsCount() const
+{
+  return _workers.size() + 1;
+}
+
+// =============================================================================
+
+void ThreadPool::RunJobs()
+{
+  while (true)
+  {
+    size_t i = _nextIndex.fetch_add(1);
+    if (i >= _jobSize)
+    {
+      break;
+    }
+
+    (*_job)(i);
+  }
+}
+
+// =============================================================================
+
+void ThreadPool::WorkerLoop()
+{
+  uint64_t seenGeneration = 0;
+
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      _wakeUp.wait(lock, [this, &seenGeneration]()
+      {
+        return (_stop or _generation != seenGeneration);
+      });
+
+      if (_stop)
+      {
+        return;
+      }
+
+      seenGeneration = _generation;
+    }
+
+    RunJobs();
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      _busyWorkers--;
+
+      if (_busyWorkers == 0)
+      {
+        _done.notify_one();
+      }
+    }
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Persistent set of worker threads, so that we don't pay for thread creation
+// every time some work needs to be spread across cores.
+//
+// Calling thread takes part in the work too, so pool of N threads
+// has N - 1 workers.
+//
+class ThreadPool
+{
+  public:
+    //
+    // 0 means std::thread::hardware_concurrency().
+    //
+    explicit ThreadPool(size_t threadsCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //
+    // Calls job(i) for every i in [0, count) and returns when all calls
+    // are done. Indices are handed out one by one as threads become free,
+    // so jobs of uneven cost are balanced automatically.
+    //
+    // Not reentrant: must be called from one thread at a time and job
+    // must not call ParallelFor() itself or throw.
+    //
+    void ParallelFor(size_t count, const std::function<void(size_t)>& job);
+
+    size_t ThreadsCount() const;
+
+  private:
+    void WorkerLoop();
+    void RunJobs();
+
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _wakeUp;
+    std::condition_variable _done;
+
+    const std::function<void(size_t)>* _job = nullptr;
+
+    size_t _jobSize     = 0;
+    size_t _busyWorkers = 0;
+
+    uint64_t _generation = 0;
+
+    bool _stop = false;
+
+    std::atomic<size_t> _nextIndex{0};
+};
+
+#endif // THREAD_POOL_H
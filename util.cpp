@@ -0,0 +1,63 @@
+#include "util.h"
+
+std::mt19937_64 RNG;
+
+// =============================================================================
+
+double Random01()
+{
+  return (double)(RNG() % 10001) / 10000.0;
+}
+
+// =============================================================================
+
+int RandomRange(int min, int max)
+{
+  if (min == max)
+  {
+    return min;
+  }
+
+  int trueMin = std::min(min, max);
+  int trueMax = std::max(min, max);
+
+  int d = std::abs(trueMax - trueMin);
+
+  int random = RNG() % d;
+
+  return trueMin + random;
+}
+
+// =============================================================================
+
+StringV StringSplit(const std::string& str, char delim)
+{
+  StringV res;
+
+  int start, end = -1;
+
+  do
+  {
+    start = end + 1;
+    end = str.find(delim, start);
+    if (end != -1)
+    {
+      std::string word = str.substr(start, end - start);
+      res.push_back(word);
+    }
+    else
+    {
+      if (start < (int)str.length())
+      {
+        res.push_back(str.substr(start, str.length()));
+      }
+      else
+      {
+        res.push_back("");
+      }
+    }
+  }
+  while (end != -1);
+
+  return res;
+}
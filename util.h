@@ -0,0 +1,18 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <random>
+
+extern std::mt19937_64 RNG;
+
+double Random01();
+int RandomRange(int min, int max);
+
+using StringV = std::vector<std::string>;
+
+StringV StringSplit(const std::string& str, char delim);
+
+#endif // UTIL_H